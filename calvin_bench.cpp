@@ -0,0 +1,186 @@
+#include <ctime>
+#include <vector>
+#include <memory>
+#include <unistd.h>
+#include <immintrin.h>
+#include "calvin.hpp"
+#include "thread_util.hpp"
+#include "random.hpp"
+#include "measure_util.hpp"
+#include "cpuid.hpp"
+#include "ycsb.hpp"
+
+const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
+
+constexpr size_t NR_BATCHES = 4; // batches in the queue.
+
+
+struct Shared
+{
+    cybozu::huge_page::Vector<uint64_t> recV;
+    std::unique_ptr<cybozu::calvin::BatchQueue> queue;
+    size_t batchSize;
+    size_t nrOp;
+    size_t nrWr;
+    int shortTxMode;
+    bool isYcsb;
+    YcsbParam ycsbParam;
+};
+
+
+enum class Mode : bool { S = false, X = true, };
+
+
+/**
+ * Worker 0 is the sequencer. It generates transactions of the workload.
+ */
+Result sequencer(const bool& start, const bool& quit, Shared& shared)
+{
+    const size_t nrOp = shared.nrOp;
+    const size_t nrWr = shared.nrWr;
+    const int shortTxMode = shared.shortTxMode;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0));
+    cybozu::calvin::Sequencer seqr(shared.recV.size());
+    cybozu::calvin::BatchQueue& queue = *shared.queue;
+    std::vector<cybozu::calvin::Access> accV;
+
+    // custom workload.
+    std::vector<bool> isWriteV(nrOp);
+    std::vector<size_t> tmpV2; // for fillModeVec.
+    BoolRandom<decltype(rand)> boolRand(rand);
+    GetModeFunc<decltype(rand), Mode>
+        getMode(boolRand, isWriteV, false, shortTxMode, USE_LAST_WRITE_TX, nrOp, nrWr);
+
+    // ycsb workload.
+    std::unique_ptr<YcsbTxGenerator<decltype(rand)> > ycsbGen;
+    if (shared.isYcsb) ycsbGen.reset(new YcsbTxGenerator<decltype(rand)>(rand, shared.ycsbParam));
+    std::vector<YcsbAccess> ycsbAccV;
+
+    while (!start) _mm_pause();
+    for (uint64_t seq = 0; !quit; seq++) {
+        cybozu::calvin::Batch* batch = queue.beginFill(seq, quit);
+        if (batch == nullptr) break;
+        for (size_t i = 0; i < shared.batchSize; i++) {
+            accV.clear();
+            if (shared.isYcsb) {
+                ycsbGen->fill(ycsbAccV, nrOp);
+                for (const YcsbAccess& acc : ycsbAccV) {
+                    accV.push_back(cybozu::calvin::Access{acc.key, acc.isWrite()});
+                }
+            } else {
+                if (shortTxMode == USE_MIX_TX) {
+                    fillModeVec(isWriteV, rand, nrWr, tmpV2);
+                }
+                for (size_t j = 0; j < nrOp; j++) {
+                    accV.push_back(cybozu::calvin::Access{rand() % shared.recV.size(), bool(getMode(j))});
+                }
+            }
+            batch->addTx(accV.begin(), accV.end());
+        }
+        seqr.build(*batch);
+        queue.publish(*batch, seq);
+    }
+    return res;
+}
+
+
+/**
+ * Each record has a counter. A write increments it.
+ */
+Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+    if (idx == 0) return sequencer(start, quit, shared);
+
+    cybozu::huge_page::Vector<uint64_t>& recV = shared.recV;
+    cybozu::calvin::BatchQueue& queue = *shared.queue;
+    Result res;
+    const bool isLongTx = false;
+    uint64_t sum = 0;
+
+    while (!start) _mm_pause();
+    for (uint64_t seq = 0; !quit; seq++) {
+        cybozu::calvin::Batch* batch = queue.get(seq, quit);
+        if (batch == nullptr) break;
+        for (;;) {
+            const size_t i = batch->take();
+            if (i >= batch->size()) break;
+            res.beginTx();
+            if (!batch->waitForDeps(i, quit)) return res;
+            for (const cybozu::calvin::Access* acc = batch->accBegin(i); acc != batch->accEnd(i); acc++) {
+                uint64_t& value = recV[acc->key];
+                if (acc->isWrite) {
+                    value++;
+                } else {
+                    sum += __atomic_load_n(&value, __ATOMIC_RELAXED);
+                }
+            }
+            batch->finish(i);
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, 0); // deterministic execution does not abort.
+        }
+        if (!batch->waitForAll(quit)) break;
+        queue.leave(*batch);
+    }
+    unused(sum);
+    return res;
+}
+
+
+struct CmdLineOptionPlus : CmdLineOption
+{
+    using base = CmdLineOption;
+
+    size_t batchSize;
+
+    CmdLineOptionPlus(const std::string& description) : CmdLineOption(description) {
+        appendOpt(&batchSize, 1000, "batch", "[num]: number of transactions in a batch (default: 1000).");
+    }
+    std::string str() const {
+        return cybozu::util::formatString("mode:calvin ") +
+            base::str() +
+            cybozu::util::formatString(" batchSize:%zu", batchSize);
+    }
+};
+
+
+int main(int argc, char *argv[]) try
+{
+    CmdLineOptionPlus opt("calvin_bench: benchmark with deterministic batch execution. Worker 0 is the sequencer.");
+    opt.parse(argc, argv);
+    if (opt.nrTh < 2) {
+        throw cybozu::Exception("nrTh must be >= 2 since worker 0 is the sequencer.") << opt.nrTh;
+    }
+    if (opt.batchSize == 0) {
+        throw cybozu::Exception("batchSize must not be 0.");
+    }
+    if (opt.longTxSize != 0) {
+        throw cybozu::Exception("long tx is not supported.") << opt.longTxSize;
+    }
+
+    Shared shared;
+    shared.recV = cybozu::huge_page::Vector<uint64_t>(opt.getNrMu());
+    shared.batchSize = opt.batchSize;
+    shared.nrOp = opt.nrOp;
+    shared.nrWr = opt.nrWr;
+    shared.shortTxMode = opt.shortTxMode;
+    if (opt.workload == "custom") {
+        shared.isYcsb = false;
+    } else if (isYcsbWorkload(opt.workload)) {
+        shared.isYcsb = true;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+    } else {
+        throw cybozu::Exception("bad workload.") << opt.workload;
+    }
+    for (size_t i = 0; i < opt.nrLoop; i++) {
+        shared.queue.reset(new cybozu::calvin::BatchQueue(NR_BATCHES, opt.nrTh - 1));
+        runExec(opt, shared, worker);
+    }
+} catch (std::exception& e) {
+    ::fprintf(::stderr, "exeption: %s\n", e.what());
+} catch (...) {
+    ::fprintf(::stderr, "unknown error\n");
+}
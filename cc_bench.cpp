@@ -0,0 +1,384 @@
+/*
+ * The record/lock layout is selected at runtime by -layout,
+ * so mutexes must not be padded by their types.
+ */
+#undef MUTEX_ON_CACHELINE
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unistd.h>
+#include <immintrin.h>
+#include "thread_util.hpp"
+#include "random.hpp"
+#include "measure_util.hpp"
+#include "cpuid.hpp"
+#include "ycsb.hpp"
+#include "cc_protocol.hpp"
+#include "record_store.hpp"
+#include "hash_index.hpp"
+
+
+const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
+
+
+template <typename Cc>
+struct Shared
+{
+    RecordStore<typename Cc::Mutex> recS;
+    bool useIndex;
+    cybozu::index::HashIndex index; // key to slot of recS.
+    size_t longTxSize;
+    size_t nrOp;
+    size_t nrWr;
+    int shortTxMode;
+    int longTxMode;
+    YcsbParam ycsbParam;
+};
+
+
+enum class Mode : bool { S = false, X = true, };
+
+
+/**
+ * Accesses of custom workload.
+ * S is a read and X is a read-modify-write.
+ */
+template <typename Random>
+class CustomTxGenerator
+{
+    Random& rand_;
+    const size_t nrMu_;
+    const size_t nrWr_;
+    const bool useMix_;
+    const size_t realNrOp_;
+    BoolRandom<Random> boolRand_;
+    std::vector<bool> isWriteV_;
+    std::vector<size_t> tmpV_; // for fillModeVec.
+    GetModeFunc<Random, Mode> getMode_;
+
+public:
+    template <typename SharedT>
+    CustomTxGenerator(Random& rand, const SharedT& shared, bool isLongTx)
+        : rand_(rand), nrMu_(shared.recS.size()), nrWr_(shared.nrWr)
+        , useMix_(!isLongTx && shared.shortTxMode == USE_MIX_TX)
+        , realNrOp_(isLongTx ? shared.longTxSize : shared.nrOp)
+        , boolRand_(rand), isWriteV_(useMix_ ? shared.nrOp : 0), tmpV_()
+        , getMode_(boolRand_, isWriteV_, isLongTx,
+                   shared.shortTxMode, shared.longTxMode, realNrOp_, nrWr_) {
+    }
+    void fill(std::vector<YcsbAccess>& accV) {
+        if (useMix_) fillModeVec(isWriteV_, rand_, nrWr_, tmpV_);
+        accV.clear();
+        for (size_t i = 0; i < realNrOp_; i++) {
+            const Mode mode = getMode_(i);
+            accV.push_back(YcsbAccess{rand_() % nrMu_, mode == Mode::X ? YcsbOpType::RMW : YcsbOpType::READ});
+        }
+    }
+};
+
+
+/**
+ * Local copies of the records accessed by a transaction.
+ * The i-th access uses the area of the first access to the same key.
+ * Protocols may call readFunc again for a record already read or written,
+ * so an area with a pending write must not be overwritten by reads.
+ */
+class LocalRecords
+{
+    size_t payload_;
+    std::vector<char> buf_;
+    std::vector<size_t> areaV_;
+    std::vector<bool> writtenV_; // the area has a pending write.
+    std::unordered_map<size_t, size_t> firstM_; // key to the first access.
+
+public:
+    explicit LocalRecords(size_t payload) : payload_(payload), buf_(), areaV_(), writtenV_(), firstM_() {}
+    /**
+     * Call this for each transaction.
+     */
+    void init(const std::vector<YcsbAccess>& accV) {
+        if (payload_ == 0) return;
+        const size_t threshold = 64;
+        buf_.resize(accV.size() * payload_);
+        areaV_.resize(accV.size());
+        firstM_.clear();
+        for (size_t i = 0; i < accV.size(); i++) {
+            const size_t key = accV[i].key;
+            if (accV.size() > threshold) {
+                areaV_[i] = firstM_.emplace(key, i).first->second;
+                continue;
+            }
+            size_t j = 0;
+            while (accV[j].key != key) j++;
+            areaV_[i] = j;
+        }
+    }
+    /**
+     * Call this for each trial.
+     */
+    void clearWritten() {
+        writtenV_.assign(areaV_.size(), false);
+    }
+    char *get(size_t i) { return payload_ == 0 ? nullptr : &buf_[areaV_[i] * payload_]; }
+    bool isWritten(size_t i) const { return payload_ != 0 && writtenV_[areaV_[i]]; }
+    void setWritten(size_t i) { writtenV_[areaV_[i]] = true; }
+};
+
+
+/**
+ * Run a trial of the transaction of accV.
+ * RETURN:
+ *   true if committed.
+ */
+template <typename Cc>
+bool runTrial(typename Cc::Tx& tx, Shared<Cc>& shared, const std::vector<YcsbAccess>& accV,
+              LocalRecords& locals, RecordWriteBuffer& writeBuf)
+{
+    using Mutex = typename Cc::Mutex;
+    const size_t payload = shared.recS.payloadSize();
+
+    writeBuf.clear();
+    locals.clearWritten();
+    bool ok = true;
+    for (size_t i = 0; i < accV.size(); i++) {
+        const YcsbAccess& acc = accV[i];
+        uint64_t slot = acc.key;
+        if (shared.useIndex && !shared.index.lookup(acc.key, slot)) {
+            throw cybozu::Exception("key not found") << acc.key;
+        }
+        Mutex& mutex = shared.recS.mutex(slot);
+        char *rec = payload == 0 ? nullptr : shared.recS.get(slot);
+        char *local = locals.get(i);
+        auto readFunc = [&]() { if (payload != 0 && !locals.isWritten(i)) ::memcpy(local, rec, payload); };
+        switch (acc.type) {
+        case YcsbOpType::READ:
+            ok = tx.read(mutex, readFunc);
+            break;
+        case YcsbOpType::UPDATE:
+            ok = tx.write(mutex);
+            if (ok && payload != 0) {
+                ::memset(local, int(i), payload);
+                if (!locals.isWritten(i)) writeBuf.add(rec, local);
+                locals.setWritten(i);
+            }
+            break;
+        case YcsbOpType::RMW:
+            ok = tx.update(mutex, readFunc);
+            if (ok && payload != 0) {
+                local[0]++;
+                if (!locals.isWritten(i)) writeBuf.add(rec, local);
+                locals.setWritten(i);
+            }
+            break;
+        }
+        if (!ok) return false;
+    }
+    return tx.commit([&]() { writeBuf.apply(); });
+}
+
+
+/**
+ * The same worker loop for all the protocols.
+ */
+template <typename Cc, bool isYcsb>
+Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared<Cc>& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    const bool isLongTx = !isYcsb && shared.longTxSize != 0 && idx == 0; // starvation setting.
+    CustomTxGenerator<decltype(rand)> customGen(rand, shared, isLongTx);
+    std::unique_ptr<YcsbTxGenerator<decltype(rand)> > ycsbGen;
+    if (isYcsb) ycsbGen.reset(new YcsbTxGenerator<decltype(rand)>(rand, shared.ycsbParam));
+    std::vector<YcsbAccess> accV;
+    typename Cc::Tx tx(idx);
+
+    const size_t payload = shared.recS.payloadSize();
+    LocalRecords locals(payload);
+    RecordWriteBuffer writeBuf(payload);
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        if (isYcsb) {
+            ycsbGen->fill(accV, nrOp);
+        } else {
+            customGen.fill(accV);
+        }
+        locals.init(accV);
+        tx.begin(isLongTx);
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            tx.beginTrial(retry);
+            if (!runTrial(tx, shared, accV, locals, writeBuf)) {
+                tx.abort();
+                const AbortReason reason = tx.abortReason();
+                if (reason == AbortReason::INTERCEPTED) {
+                    res.incIntercepted(isLongTx);
+                } else {
+                    res.incAbort(isLongTx, reason);
+                }
+                continue;
+            }
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+    }
+    return res;
+}
+
+
+/**
+ * A read after a write of the same record in a transaction must not
+ * overwrite the pending write. Checked with a single record before running.
+ */
+template <typename Cc>
+void checkReadAfterWrite()
+{
+    const size_t payload = 8;
+    Shared<Cc> shared;
+    shared.recS.init(1, payload, RecordLayout::PADDED);
+    shared.useIndex = false;
+    ::memset(shared.recS.get(0), 0xff, payload);
+
+    typename Cc::Tx tx(0);
+    LocalRecords locals(payload);
+    RecordWriteBuffer writeBuf(payload);
+    const std::vector<YcsbAccess> accV = {
+        YcsbAccess{0, YcsbOpType::UPDATE}, YcsbAccess{0, YcsbOpType::READ},
+    };
+    locals.init(accV);
+    tx.begin(false);
+    const size_t maxRetry = 100;
+    for (size_t retry = 0;; retry++) {
+        if (retry == maxRetry) throw cybozu::Exception("checkReadAfterWrite: not committed") << Cc::NAME;
+        tx.beginTrial(retry);
+        if (runTrial(tx, shared, accV, locals, writeBuf)) break;
+        tx.abort();
+    }
+    const char *rec = shared.recS.get(0);
+    for (size_t i = 0; i < payload; i++) {
+        if (rec[i] != 0) throw cybozu::Exception("checkReadAfterWrite: the write was lost") << Cc::NAME;
+    }
+}
+
+
+struct CmdLineOptionPlus : CmdLineOption
+{
+    using base = CmdLineOption;
+
+    std::string cc;
+    size_t payloadSize;
+    std::string layoutStr;
+    RecordLayout layout;
+    bool useIndex;
+    std::string modeStr; // set by the protocol.
+
+    CmdLineOptionPlus(const std::string& description) : CmdLineOption(description) {
+        appendOpt(&cc, "silo", "cc", "[protocol]: concurrency control in silo, mocc, tictoc, waitdie, woundwait, dl-detect, dl-detect-periodic, nowait, leis, trlock, trlock-occ, trlock-hybrid (default: silo).");
+        appendOpt(&payloadSize, 0, "payload", "[bytes]: payload size of each record (default: 0, no payload).");
+        appendOpt(&layoutStr, "padded", "layout", "[type]: record/lock layout in 'packed', 'padded', 'embedded' or 'embedded-padded' (default: padded).");
+        appendBoolOpt(&useIndex, "index", ": look up records with the hash index instead of using keys as slots.");
+    }
+    void parse(int argc, char *argv[]) {
+        base::parse(argc, argv);
+        layout = parseRecordLayout(layoutStr);
+    }
+    std::string str() const {
+        return cybozu::util::formatString("mode:%s ", modeStr.c_str()) + base::str()
+            + cybozu::util::formatString(" payload:%zu layout:%s index:%d", payloadSize, layoutStr.c_str(), useIndex);
+    }
+};
+
+
+template <typename Cc>
+void dispatch1(CmdLineOptionPlus& opt)
+{
+    opt.modeStr = Cc::NAME;
+    checkReadAfterWrite<Cc>();
+    Shared<Cc> shared;
+    shared.recS.init(opt.getNrMu(), opt.payloadSize, opt.layout);
+    shared.useIndex = opt.useIndex;
+    if (opt.useIndex) {
+        shared.index.init(opt.getNrMu());
+        for (size_t i = 0; i < opt.getNrMu(); i++) {
+            shared.index.insert(i, i);
+        }
+    }
+    shared.nrOp = opt.nrOp;
+    shared.nrWr = opt.nrWr;
+    shared.shortTxMode = opt.shortTxMode;
+    shared.longTxMode = opt.longTxMode;
+    if (opt.workload == "custom") {
+        shared.longTxSize = opt.longTxSize;
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, worker<Cc, false>);
+        }
+    } else if (isYcsbWorkload(opt.workload)) {
+        shared.longTxSize = 0;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, worker<Cc, true>);
+        }
+    } else {
+        throw cybozu::Exception("bad workload.") << opt.workload;
+    }
+}
+
+
+void dispatch0(CmdLineOptionPlus& opt)
+{
+    if (opt.cc == "silo") {
+        cybozu::occ::EpochAdvancer epochAdvancer;
+        dispatch1<SiloCc>(opt);
+    } else if (opt.cc == "mocc") {
+        cybozu::occ::EpochAdvancer epochAdvancer;
+        dispatch1<MoccCc>(opt);
+    } else if (opt.cc == "tictoc") {
+        dispatch1<TictocCc>(opt);
+    } else if (opt.cc == "waitdie") {
+        dispatch1<WaitDieCc>(opt);
+    } else if (opt.cc == "woundwait") {
+        dispatch1<WoundWaitCc>(opt);
+    } else if (opt.cc == "dl-detect") {
+        cybozu::dl_detect::waitForGraph().setMode(cybozu::dl_detect::DetectMode::ON_BLOCK);
+        dispatch1<DlDetectCc<cybozu::dl_detect::DetectMode::ON_BLOCK> >(opt);
+    } else if (opt.cc == "dl-detect-periodic") {
+        cybozu::dl_detect::waitForGraph().setMode(cybozu::dl_detect::DetectMode::PERIODIC);
+        cybozu::dl_detect::PeriodicDetector detector;
+        dispatch1<DlDetectCc<cybozu::dl_detect::DetectMode::PERIODIC> >(opt);
+    } else if (opt.cc == "nowait") {
+        dispatch1<NoWaitCc>(opt);
+    } else if (opt.cc == "leis") {
+        dispatch1<LeisCc>(opt);
+    } else if (opt.cc == "trlock") {
+        dispatch1<TrlockCc<TrlockReadMode::LOCK> >(opt);
+    } else if (opt.cc == "trlock-occ") {
+        dispatch1<TrlockCc<TrlockReadMode::OCC> >(opt);
+    } else if (opt.cc == "trlock-hybrid") {
+        dispatch1<TrlockCc<TrlockReadMode::HYBRID> >(opt);
+    } else {
+        throw cybozu::Exception("bad cc") << opt.cc;
+    }
+}
+
+
+int main(int argc, char *argv[]) try
+{
+    CmdLineOptionPlus opt("cc_bench: benchmark with a concurrency control protocol.");
+    opt.parse(argc, argv);
+    dispatch0(opt);
+
+} catch (std::exception& e) {
+    ::fprintf(::stderr, "exeption: %s\n", e.what());
+} catch (...) {
+    ::fprintf(::stderr, "unknown error\n");
+}
@@ -0,0 +1,450 @@
+#pragma once
+/*
+ * Concurrency control protocols for cc_bench with the same interface.
+ *
+ * struct XxxCc
+ * {
+ *     using Mutex = ...;
+ *     static constexpr const char *NAME; // printed as mode.
+ *
+ *     class Tx // one instance per worker.
+ *     {
+ *         explicit Tx(size_t idx); // idx: worker index.
+ *         void begin(bool isLongTx); // call this once per transaction.
+ *         void beginTrial(size_t retry); // call this before each trial.
+ *         bool read(Mutex&, ReadFunc&&);
+ *         bool write(Mutex&); // blind write.
+ *         bool update(Mutex&, ReadFunc&&); // read-modify-write.
+ *         bool commit(WriteFunc&&);
+ *         void abort(); // call this after any of the above failed.
+ *         AbortReason abortReason() const; // reason of the last failure.
+ *     };
+ * };
+ *
+ * read/write/update/commit return false if the transaction must abort.
+ * ReadFunc: void()
+ *   copy the record to local memory. It may be called several times,
+ *   or not called if the record has been read by the transaction.
+ * WriteFunc: void()
+ *   install the buffered writes. It is called only if the transaction can commit.
+ */
+#include <utility>
+#include "measure_util.hpp"
+#include "tx_util.hpp"
+#include "occ.hpp"
+#include "mocc.hpp"
+#include "tictoc.hpp"
+#include "wait_die.hpp"
+#include "dl_detect.hpp"
+#include "lock.hpp"
+#include "leis_lock.hpp"
+#include "trlock.hpp"
+
+
+struct SiloCc
+{
+    using Mutex = cybozu::occ::OccLock::Mutex;
+    static constexpr const char *NAME = "silo-occ";
+
+    class Tx
+    {
+        cybozu::occ::LockSet lockSet_;
+    public:
+        explicit Tx(size_t) : lockSet_() {}
+        void begin(bool) {}
+        void beginTrial(size_t) { assert(lockSet_.empty()); }
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            lockSet_.read(mutex, std::forward<ReadFunc>(readFunc));
+            return true;
+        }
+        bool write(Mutex& mutex) { lockSet_.write(mutex); return true; }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            lockSet_.read(mutex, std::forward<ReadFunc>(readFunc));
+            lockSet_.write(mutex);
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            lockSet_.lock();
+            if (!lockSet_.verify()) return false;
+            writeFunc();
+            lockSet_.updateAndUnlock();
+            return true;
+        }
+        void abort() { lockSet_.clear(); }
+        AbortReason abortReason() const { return AbortReason::VALIDATION; }
+    };
+};
+
+
+/**
+ * Hot records are locked pessimistically.
+ * Run cybozu::occ::EpochAdvancer so that temperatures cool down.
+ */
+struct MoccCc
+{
+    using Mutex = cybozu::mocc::Mutex;
+    static constexpr const char *NAME = "mocc";
+
+    class Tx
+    {
+        cybozu::mocc::LocalSet localSet_;
+    public:
+        explicit Tx(size_t) : localSet_() {}
+        void begin(bool) {}
+        void beginTrial(size_t retry) { assert(localSet_.empty()); localSet_.begin(retry != 0); }
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            localSet_.read(mutex, std::forward<ReadFunc>(readFunc));
+            return true;
+        }
+        bool write(Mutex& mutex) { localSet_.write(mutex); return true; }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            localSet_.update(mutex, std::forward<ReadFunc>(readFunc));
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            return localSet_.preCommit(std::forward<WriteFunc>(writeFunc));
+        }
+        void abort() { localSet_.abort(); }
+        AbortReason abortReason() const { return AbortReason::VALIDATION; }
+    };
+};
+
+
+struct TictocCc
+{
+    using Mutex = cybozu::tictoc::Mutex;
+    static constexpr const char *NAME = "tictoc";
+
+    class Tx
+    {
+        cybozu::tictoc::LocalSet localSet_;
+    public:
+        explicit Tx(size_t) : localSet_() {}
+        void begin(bool) {}
+        void beginTrial(size_t) {}
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            localSet_.read(mutex, std::forward<ReadFunc>(readFunc));
+            return true;
+        }
+        bool write(Mutex& mutex) { localSet_.write(mutex); return true; }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            localSet_.read(mutex, std::forward<ReadFunc>(readFunc));
+            localSet_.write(mutex);
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            return localSet_.preCommit(std::forward<WriteFunc>(writeFunc));
+        }
+        void abort() { localSet_.clear(); }
+        AbortReason abortReason() const { return AbortReason::VALIDATION; }
+    };
+};
+
+
+struct WaitDieCc
+{
+    using Mutex = cybozu::wait_die::WaitDieLock::Mutex;
+    static constexpr const char *NAME = "wait-die";
+
+    class Tx
+    {
+        cybozu::wait_die::LockSet lockSet_;
+        PriorityIdGenerator<12> priIdGen_;
+    public:
+        explicit Tx(size_t idx) : lockSet_(), priIdGen_() {
+            priIdGen_.init(idx + 1);
+        }
+        void begin(bool isLongTx) { lockSet_.setTxId(priIdGen_.get(isLongTx ? 0 : 1)); }
+        void beginTrial(size_t) { assert(lockSet_.empty()); }
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.read(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        bool write(Mutex& mutex) { return lockSet_.write(mutex); }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.write(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            writeFunc();
+            lockSet_.clear(); // unlock.
+            return true;
+        }
+        void abort() { lockSet_.clear(); }
+        AbortReason abortReason() const {
+            return lockSet_.isUpgradeFailed() ? AbortReason::UPGRADE : AbortReason::DIE;
+        }
+    };
+};
+
+
+struct WoundWaitCc
+{
+    using Mutex = cybozu::wait_die::WoundWaitLock::Mutex;
+    static constexpr const char *NAME = "wound-wait";
+
+    class Tx
+    {
+        cybozu::wait_die::WoundWaitLockSet lockSet_;
+        PriorityIdGenerator<12> priIdGen_;
+    public:
+        explicit Tx(size_t idx) : lockSet_(), priIdGen_() {
+            priIdGen_.init(idx + 1);
+        }
+        void begin(bool isLongTx) { lockSet_.setTxId(priIdGen_.get(isLongTx ? 0 : 1)); }
+        void beginTrial(size_t) { assert(lockSet_.empty()); }
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.read(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        bool write(Mutex& mutex) { return lockSet_.write(mutex); }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.write(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            writeFunc();
+            lockSet_.clear(); // unlock.
+            return true;
+        }
+        void abort() { lockSet_.clear(); }
+        AbortReason abortReason() const { return AbortReason::WOUNDED; }
+    };
+};
+
+
+/**
+ * Set the detection mode of cybozu::dl_detect::waitForGraph() before running,
+ * and run cybozu::dl_detect::PeriodicDetector for the periodic mode.
+ */
+template <cybozu::dl_detect::DetectMode dmode>
+struct DlDetectCc
+{
+    using Mutex = cybozu::dl_detect::Mutex;
+    static constexpr const char *NAME =
+        dmode == cybozu::dl_detect::DetectMode::ON_BLOCK ? "dl-detect" : "dl-detect-periodic";
+
+    class Tx
+    {
+        cybozu::dl_detect::LockSet lockSet_;
+        PriorityIdGenerator<12> priIdGen_;
+    public:
+        explicit Tx(size_t idx) : lockSet_(idx), priIdGen_() {
+            priIdGen_.init(idx + 1);
+        }
+        void begin(bool isLongTx) { lockSet_.setTxId(priIdGen_.get(isLongTx ? 0 : 1)); }
+        void beginTrial(size_t) { assert(lockSet_.empty()); }
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.read(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        bool write(Mutex& mutex) { return lockSet_.write(mutex); }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.write(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            writeFunc();
+            lockSet_.clear(); // unlock.
+            return true;
+        }
+        void abort() { lockSet_.clear(); }
+        AbortReason abortReason() const { return AbortReason::DEADLOCK; }
+    };
+};
+
+
+struct NoWaitCc
+{
+    using Mutex = cybozu::lock::XSMutex;
+    static constexpr const char *NAME = "nowait";
+
+    class Tx
+    {
+        cybozu::lock::NoWaitLockSet lockSet_;
+    public:
+        explicit Tx(size_t) : lockSet_() {}
+        void begin(bool) {}
+        void beginTrial(size_t) { assert(lockSet_.empty()); }
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.read(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        bool write(Mutex& mutex) { return lockSet_.write(mutex); }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!lockSet_.write(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            writeFunc();
+            lockSet_.clear(); // unlock.
+            return true;
+        }
+        void abort() { lockSet_.clear(); }
+        AbortReason abortReason() const {
+            return lockSet_.isUpgradeFailed() ? AbortReason::UPGRADE : AbortReason::LOCK_CONFLICT;
+        }
+    };
+};
+
+
+struct LeisCc
+{
+    using LockSet = cybozu::lock::LeisLockSet<1>;
+    using Mutex = LockSet::Mutex;
+    using Mode = LockSet::Mode;
+    static constexpr const char *NAME = "leis";
+
+    class Tx
+    {
+        LockSet llSet_;
+    public:
+        explicit Tx(size_t) : llSet_() {}
+        void begin(bool) { assert(llSet_.empty()); }
+        void beginTrial(size_t) {}
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!llSet_.lock(&mutex, Mode::S)) return false;
+            readFunc();
+            return true;
+        }
+        bool write(Mutex& mutex) { return llSet_.lock(&mutex, Mode::X); }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            if (!llSet_.lock(&mutex, Mode::X)) return false;
+            readFunc();
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            writeFunc();
+            llSet_.unlock();
+            return true;
+        }
+        /**
+         * Locks in the right order are kept for the next trial.
+         */
+        void abort() { llSet_.recover(); }
+        AbortReason abortReason() const { return AbortReason::LOCK_ORDER; }
+    };
+};
+
+
+enum class TrlockReadMode : uint8_t { LOCK, OCC, HYBRID };
+
+/**
+ * Transferable/interceptible lock without priority queue locks.
+ */
+template <TrlockReadMode rmode>
+struct TrlockCc
+{
+    using PQLock = cybozu::lock::PQNoneLock;
+    using LockSet = cybozu::lock::ILockSet<PQLock>;
+    using Mutex = typename LockSet::Mutex;
+    static constexpr const char *NAME =
+        rmode == TrlockReadMode::LOCK ? "trlock" :
+        rmode == TrlockReadMode::OCC ? "trlock-occ" : "trlock-hybrid";
+
+    class Tx
+    {
+        LockSet lockSet_;
+        PriorityIdGenerator<12> priIdGen_;
+        bool isLongTx_;
+        bool tryOccRead_;
+        AbortReason reason_;
+    public:
+        explicit Tx(size_t idx)
+            : lockSet_(), priIdGen_(), isLongTx_(false), tryOccRead_(false)
+            , reason_(AbortReason::VALIDATION) {
+            priIdGen_.init(idx + 1);
+        }
+        void begin(bool isLongTx) {
+            isLongTx_ = isLongTx;
+            assert(lockSet_.isEmpty());
+            lockSet_.setPriorityId(priIdGen_.get(isLongTx ? 0 : 1));
+        }
+        void beginTrial(size_t retry) {
+            tryOccRead_ = rmode == TrlockReadMode::OCC
+                || (rmode == TrlockReadMode::HYBRID && !isLongTx_ && retry == 0);
+        }
+        /**
+         * Optimistic reads are validated at commit.
+         */
+        template <typename ReadFunc>
+        bool read(Mutex& mutex, ReadFunc&& readFunc) {
+            if (tryOccRead_) {
+                bool ret = lockSet_.optimisticRead(mutex);
+                unused(ret);
+                assert(ret);
+            } else if (!lockSet_.pessimisticRead(mutex)) {
+                reason_ = AbortReason::VALIDATION;
+                return false;
+            }
+            readFunc();
+            return true;
+        }
+        bool write(Mutex& mutex) {
+            if (!lockSet_.write(mutex)) {
+                reason_ = AbortReason::INTERCEPTED;
+                return false;
+            }
+            return true;
+        }
+        template <typename ReadFunc>
+        bool update(Mutex& mutex, ReadFunc&& readFunc) {
+            if (tryOccRead_) {
+                bool ret = lockSet_.optimisticRead(mutex);
+                unused(ret);
+                assert(ret);
+            }
+            if (!write(mutex)) return false;
+            readFunc();
+            return true;
+        }
+        template <typename WriteFunc>
+        bool commit(WriteFunc&& writeFunc) {
+            if (!lockSet_.protect()) {
+                reason_ = AbortReason::INTERCEPTED;
+                return false;
+            }
+            if (!lockSet_.verify()) {
+                reason_ = AbortReason::VALIDATION;
+                return false;
+            }
+            writeFunc();
+            lockSet_.updateAndUnlock();
+            return true;
+        }
+        void abort() { lockSet_.clear(); }
+        AbortReason abortReason() const { return reason_; }
+    };
+};
@@ -0,0 +1,203 @@
+#include <ctime>
+#include <vector>
+#include <unistd.h>
+#include <immintrin.h>
+#include "cicada.hpp"
+#include "thread_util.hpp"
+#include "random.hpp"
+#include "measure_util.hpp"
+#include "cpuid.hpp"
+#include "ycsb.hpp"
+
+using Record = cybozu::cicada::Record;
+
+const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
+
+
+struct Shared
+{
+    cybozu::huge_page::Vector<Record> recV;
+    cybozu::cicada::TimestampManager tsm;
+    size_t longTxSize;
+    size_t nrOp;
+    size_t nrWr;
+    int shortTxMode;
+    int longTxMode;
+    YcsbParam ycsbParam;
+};
+
+
+enum class Mode : bool { S = false, X = true, };
+
+
+/**
+ * Each record has a counter. A write increments it.
+ */
+Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Record>& recV = shared.recV;
+    const size_t longTxSize = shared.longTxSize;
+    const size_t nrOp = shared.nrOp;
+    const size_t nrWr = shared.nrWr;
+    const int shortTxMode = shared.shortTxMode;
+    const int longTxMode = shared.longTxMode;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    cybozu::cicada::LocalSet localSet(shared.tsm, *epochManagerOfThisThread(), idx);
+
+    // USE_MIX_TX
+    std::vector<bool> isWriteV(nrOp);
+    std::vector<size_t> tmpV2; // for fillModeVec.
+
+    // USE_LONG_TX_2
+    BoolRandom<decltype(rand)> boolRand(rand);
+
+    const bool isLongTx = longTxSize != 0 && idx == 0; // starvation setting.
+    const size_t realNrOp = isLongTx ? longTxSize : nrOp;
+    if (!isLongTx && shortTxMode == USE_MIX_TX) {
+        isWriteV.resize(nrOp);
+    }
+    const bool isReadOnly = (isLongTx ? longTxMode : shortTxMode) == USE_READONLY_TX;
+    GetModeFunc<decltype(rand), Mode>
+        getMode(boolRand, isWriteV, isLongTx,
+                shortTxMode, longTxMode, realNrOp, nrWr);
+
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        if (!isLongTx && shortTxMode == USE_MIX_TX) {
+            fillModeVec(isWriteV, rand, nrWr, tmpV2);
+        }
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            // Try to run transaction.
+            localSet.begin(isReadOnly);
+            bool ok = true;
+            for (size_t i = 0; i < realNrOp; i++) {
+                const bool isWrite = bool(getMode(i));
+                Record& rec = recV[rand() % recV.size()];
+                uint64_t value;
+                ok = localSet.read(rec, value);
+                if (ok && isWrite) ok = localSet.write(rec, value + 1);
+                if (!ok) break;
+            }
+            if (ok) ok = localSet.preCommit();
+            if (!ok) {
+                localSet.abort();
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                continue;
+            }
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+    }
+    return res;
+}
+
+
+Result ycsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Record>& recV = shared.recV;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+    cybozu::cicada::LocalSet localSet(shared.tsm, *epochManagerOfThisThread(), idx);
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+        const bool isReadOnly = std::none_of(
+            accV.begin(), accV.end(), [](const YcsbAccess& acc) { return acc.isWrite(); });
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            // Try to run transaction.
+            localSet.begin(isReadOnly);
+            bool ok = true;
+            for (const YcsbAccess& acc : accV) {
+                Record& rec = recV[acc.key];
+                uint64_t value = 0;
+                if (acc.isRead()) ok = localSet.read(rec, value);
+                if (ok && acc.isWrite()) ok = localSet.write(rec, value + 1);
+                if (!ok) break;
+            }
+            if (ok) ok = localSet.preCommit();
+            if (!ok) {
+                localSet.abort();
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                continue;
+            }
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+    }
+    return res;
+}
+
+
+struct CmdLineOptionPlus : CmdLineOption
+{
+    using base = CmdLineOption;
+
+    CmdLineOptionPlus(const std::string& description) : CmdLineOption(description) {
+    }
+    std::string str() const {
+        return cybozu::util::formatString("mode:cicada ") + base::str();
+    }
+};
+
+
+int main(int argc, char *argv[]) try
+{
+    CmdLineOptionPlus opt("cicada_bench: benchmark with cicada.");
+    opt.parse(argc, argv);
+
+    if (opt.workload == "custom") {
+        Shared shared;
+        shared.recV = cybozu::huge_page::Vector<Record>(opt.getNrMu());
+        shared.tsm.init(opt.nrTh);
+        shared.longTxSize = opt.longTxSize;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, worker2);
+        }
+    } else if (isYcsbWorkload(opt.workload)) {
+        Shared shared;
+        shared.recV = cybozu::huge_page::Vector<Record>(opt.getNrMu());
+        shared.tsm.init(opt.nrTh);
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, ycsbWorker);
+        }
+    } else {
+        throw cybozu::Exception("bad workload.") << opt.workload;
+    }
+} catch (std::exception& e) {
+    ::fprintf(::stderr, "exeption: %s\n", e.what());
+} catch (...) {
+    ::fprintf(::stderr, "unknown error\n");
+}
@@ -2,6 +2,7 @@
 
 #include "cybozu/option.hpp"
 #include "cybozu/exception.hpp"
+#include "huge_page.hpp"
 #include <string>
 
 struct CmdLineOption : cybozu::Option
@@ -10,6 +11,7 @@ struct CmdLineOption : cybozu::Option
 
     size_t nrTh; // Number of worker threads (concurrency).
     size_t runSec; // Running period [sec].
+    size_t warmupSec; // Warm-up period before runSec [sec]. Its counts are discarded.
     size_t nrLoop; // Number of run.
     size_t nrMuPerTh; // number of mutexes per thread
     size_t nrMu;  // total number of mutexes. (used if nrMuPerTh is 0)
@@ -19,6 +21,14 @@ struct CmdLineOption : cybozu::Option
     size_t nrWr; // Number of write operations of short transactions.
     int shortTxMode; // Short transaction mode. See enum TxMode.
     int longTxMode; // Long transaction mode. See enum TxMode.
+    double theta; // Zipfian skew parameter for ycsb workloads.
+    size_t nrWh; // Number of warehouses for tpcc workload.
+    size_t insPct; // Percentage of inserts and also of deletes for insert workload.
+    size_t intervalMs; // Interval to put throughput timeline [ms]. 0 means no timeline.
+    bool usePerf; // Count hardware events of workers.
+    size_t perfRaw; // Raw perf event config like HITM. 0 means not used.
+    std::string outFormat; // "text", "json" or "csv".
+    std::string hugePage; // page backing of mutex and record arrays. See cybozu::huge_page::Mode.
     bool verbose; // verbose mode.
 
     constexpr static const char *NAME = "CmdLineOption";
@@ -27,15 +37,24 @@ struct CmdLineOption : cybozu::Option
         setDescription(description);
         appendMust(&nrTh, "th", "[num]: number of worker threads.");
         appendOpt(&runSec, 10, "p", "[second]: running period (default: 10).");
+        appendOpt(&warmupSec, 0, "warmup", "[second]: warm-up period before running period (default: 0).");
         appendOpt(&nrLoop, 1, "loop", "[num]: number of run (default: 1).");
+        appendOpt(&insPct, 20, "ins", "[pct]: percentage of inserts, and the same of deletes, in operations of insert workload (default: 20).");
         appendOpt(&nrMuPerTh, 0, "mupt", "[num]: number of mutexes per thread (use this for shortlong workload).");
         appendOpt(&nrMu, 0, "mu", "[num]: total number of mutexes (use this for other workloads).");
-        appendOpt(&workload, "custom", "w", "[workload]: workload type in 'custom', 'custom-t' etc.");
+        appendOpt(&workload, "custom", "w", "[workload]: workload type in 'custom', 'custom-t', 'ycsb-a' to 'ycsb-f', 'tpcc', 'insert' etc.");
         appendOpt(&longTxSize, 0, "long-tx-size", "[size]: long tx size for shortlong workload. 0 means no long tx.");
         appendOpt(&nrOp, 4, "nrop", "[num]: number of operations of short transactions (default:4).");
         appendOpt(&nrWr, 2, "nrwr", "[num]: number of write operations of short transactions (default:2).");
         appendOpt(&shortTxMode, 0, "sm", "[id]: short Tx mode (0:last-writes, 1:first-writes, 2:read-only, 3:write-only, 4:half-and-half, 5:mix)");
         appendOpt(&longTxMode, 0, "lm", "[id]: long Tx mode (0:last-writes, 1:first-writes, 2:read-only, 4:half-and-half)");
+        appendOpt(&theta, 0.99, "theta", "[value]: zipfian theta in [0, 1) for ycsb workloads (default: 0.99). 0 means uniform.");
+        appendOpt(&nrWh, 1, "wh", "[num]: number of warehouses for tpcc workload (default: 1).");
+        appendOpt(&intervalMs, 0, "interval", "[ms]: put throughput timeline every interval (default: 0, no timeline).");
+        appendBoolOpt(&usePerf, "perf", ": count cycles, instructions and LLC misses per commit.");
+        appendOpt(&perfRaw, 0, "perf-raw", "[config]: raw perf event counted with -perf like 0x04d2 (default: 0, not used).");
+        appendOpt(&hugePage, "none", "hp", "[mode]: pages of mutex and record arrays in 'none', 'thp', '2m' or '1g' (default: none). Falls back to weaker modes. 'thp' is only advised, and the kernel may not back all the pages.");
+        appendOpt(&outFormat, "text", "out", "[format]: result format in 'text', 'json' or 'csv' (default: text).");
         appendBoolOpt(&verbose, "v", ": puts verbose messages.");
         appendHelp("h", ": put this message.");
     }
@@ -53,7 +72,7 @@ struct CmdLineOption : cybozu::Option
         if (nrLoop == 0) {
             throw cybozu::Exception(NAME) << "nrLoop must not be 0.";
         }
-        if (nrMuPerTh == 0 && nrMu == 0) {
+        if (nrMuPerTh == 0 && nrMu == 0 && workload != "tpcc") {
             throw cybozu::Exception(NAME) << "nrMuPerTh or nrMu must not be 0.";
         }
         if (longTxSize > getNrMu()) {
@@ -62,6 +81,19 @@ struct CmdLineOption : cybozu::Option
         if (nrOp < nrWr) {
             throw cybozu::Exception(NAME) << "nrOp must be >= nrWr.";
         }
+        if (theta < 0.0 || theta >= 1.0) {
+            throw cybozu::Exception(NAME) << "theta must be in [0, 1)." << theta;
+        }
+        if (nrWh == 0) {
+            throw cybozu::Exception(NAME) << "nrWh must not be 0.";
+        }
+        if (outFormat != "text" && outFormat != "json" && outFormat != "csv") {
+            throw cybozu::Exception(NAME) << "bad outFormat." << outFormat;
+        }
+        if (insPct > 50) {
+            throw cybozu::Exception(NAME) << "insPct must be <= 50." << insPct;
+        }
+        cybozu::huge_page::setMode(cybozu::huge_page::parseMode(hugePage));
     }
     size_t getNrMuPerTh() const {
         return nrMuPerTh > 0 ? nrMuPerTh : nrMu / nrTh;
@@ -72,8 +104,10 @@ struct CmdLineOption : cybozu::Option
     virtual std::string str() const {
         return cybozu::util::formatString(
             "concurrency:%zu workload:%s nrMutex:%zu nrMuPerTh:%zu "
-            "sec:%zu longTxSize:%zu nrOp:%zu nrWr:%zu shortTxMode:%d longTxMode:%d"
+            "sec:%zu warmup:%zu longTxSize:%zu nrOp:%zu nrWr:%zu shortTxMode:%d longTxMode:%d theta:%.3f nrWh:%zu ins:%zu"
+            " hugePage:%s hugePageObtained:%s"
             , nrTh, workload.c_str(), getNrMu(), getNrMuPerTh()
-            , runSec, longTxSize, nrOp, nrWr, shortTxMode, longTxMode);
+            , runSec, warmupSec, longTxSize, nrOp, nrWr, shortTxMode, longTxMode, theta, nrWh, insPct
+            , hugePage.c_str(), cybozu::huge_page::modeStr(cybozu::huge_page::obtainedMode()));
     }
 };
@@ -0,0 +1,398 @@
+#pragma once
+/**
+ * @file
+ * @brief Concurrent B+-tree mapping 64-bit keys to 64-bit values.
+ *
+ * Optimistic lock coupling [Leis et al. 2016]:
+ * each node has a version word, readers validate it instead of locking,
+ * and writers lock it only to modify the node.
+ * Full nodes are split eagerly on the way down.
+ * Nodes are never merged or freed until the tree is destroyed,
+ * so readers can follow any pointer they have read.
+ */
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <immintrin.h>
+
+
+namespace cybozu {
+namespace index {
+
+class BTree
+{
+public:
+    using Key = uint64_t;
+    using Value = uint64_t;
+
+private:
+    static constexpr size_t NR_INNER_KEYS = 31;
+    static constexpr size_t NR_LEAF_KEYS = 32;
+
+    struct Node
+    {
+        /*
+         * bit 0: lock flag.
+         * Unlocking adds one, so it increments the version.
+         */
+        uint64_t version;
+        bool isLeaf;
+        uint16_t count;
+
+        explicit Node(bool isLeaf0) : version(0), isLeaf(isLeaf0), count(0) {}
+        /**
+         * RETURN:
+         *   false if the node is being modified.
+         */
+        bool readLock(uint64_t& v) const {
+            v = __atomic_load_n(&version, __ATOMIC_ACQUIRE);
+            return (v & 1) == 0;
+        }
+        bool check(uint64_t v) const {
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            return __atomic_load_n(&version, __ATOMIC_RELAXED) == v;
+        }
+        bool tryUpgrade(uint64_t v) {
+            return __atomic_compare_exchange_n(&version, &v, v + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+        }
+        void unlock() {
+            assert((version & 1) != 0);
+            __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE);
+        }
+        /**
+         * The count may be broken while another thread modifies the node.
+         */
+        size_t safeCount(size_t max) const {
+            return std::min<size_t>(count, max);
+        }
+    };
+
+    struct Inner : Node
+    {
+        /*
+         * children[i] has keys <= keys[i],
+         * and children[count] has keys > keys[count - 1].
+         */
+        Key keys[NR_INNER_KEYS];
+        Node *children[NR_INNER_KEYS + 1];
+
+        Inner() : Node(false) {}
+        bool isFull() const { return count == NR_INNER_KEYS; }
+        size_t lowerBound(Key key) const {
+            const size_t n = safeCount(NR_INNER_KEYS);
+            return std::lower_bound(&keys[0], &keys[n], key) - &keys[0];
+        }
+        /**
+         * right will have the upper half. sep is the separator to the parent.
+         */
+        Inner *split(Key& sep) {
+            Inner *right = new Inner();
+            const size_t half = count / 2;
+            sep = keys[half];
+            right->count = count - half - 1;
+            std::copy(&keys[half + 1], &keys[count], &right->keys[0]);
+            std::copy(&children[half + 1], &children[count + 1], &right->children[0]);
+            count = half;
+            return right;
+        }
+        /**
+         * Insert sep and the right child of the child that has been split.
+         */
+        void insert(Key sep, Node *right) {
+            assert(!isFull());
+            const size_t pos = lowerBound(sep);
+            std::copy_backward(&keys[pos], &keys[count], &keys[count + 1]);
+            std::copy_backward(&children[pos + 1], &children[count + 1], &children[count + 2]);
+            keys[pos] = sep;
+            children[pos + 1] = right;
+            count++;
+        }
+    };
+
+    struct Leaf : Node
+    {
+        Key keys[NR_LEAF_KEYS];
+        Value values[NR_LEAF_KEYS];
+        Leaf *next; // right sibling for scans.
+
+        Leaf() : Node(true), next(nullptr) {}
+        bool isFull() const { return count == NR_LEAF_KEYS; }
+        size_t lowerBound(Key key) const {
+            const size_t n = safeCount(NR_LEAF_KEYS);
+            return std::lower_bound(&keys[0], &keys[n], key) - &keys[0];
+        }
+        Leaf *split(Key& sep) {
+            Leaf *right = new Leaf();
+            const size_t half = count / 2;
+            right->count = count - half;
+            std::copy(&keys[half], &keys[count], &right->keys[0]);
+            std::copy(&values[half], &values[count], &right->values[0]);
+            right->next = next;
+            count = half;
+            sep = keys[half - 1];
+            __atomic_store_n(&next, right, __ATOMIC_RELEASE);
+            return right;
+        }
+    };
+
+    enum class Ret : uint8_t { OK, FAILED, RESTART, };
+
+    Node *root_;
+
+public:
+    BTree() : root_(new Leaf()) {}
+    ~BTree() noexcept {
+        freeNode(root_);
+    }
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    /**
+     * Do not call this concurrently with the other member functions.
+     */
+    void clear() {
+        freeNode(root_);
+        root_ = new Leaf();
+    }
+    /**
+     * RETURN:
+     *   false if the key already exists.
+     */
+    bool insert(Key key, Value value) {
+        return retry([&]() { return tryInsert(key, value); });
+    }
+    /**
+     * RETURN:
+     *   false if the key does not exist.
+     */
+    bool erase(Key key) {
+        Value value;
+        return erase(key, value);
+    }
+    /**
+     * value: the erased value.
+     */
+    bool erase(Key key, Value& value) {
+        return retry([&]() { return tryErase(key, value); });
+    }
+    /**
+     * RETURN:
+     *   false if the key does not exist.
+     */
+    bool lookup(Key key, Value& value) const {
+        return retry([&]() { return tryLookup(key, value); });
+    }
+    /**
+     * Call func(key, value) for each key in [lo, hi) in ascending order.
+     * func returns false to stop the scan.
+     * Each leaf is read consistently, but the scan as a whole is not atomic.
+     */
+    template <typename Func>
+    void scan(Key lo, Key hi, Func&& func) const {
+        scan(lo, hi, std::forward<Func>(func), [](const uint64_t&, uint64_t) {});
+    }
+    /**
+     * leafFunc(const uint64_t& versionWord, uint64_t version) is called
+     * for each leaf before func is called for its keys.
+     * The keys put from the leaf are still the same if the word equals the version.
+     * Inserts and deletes in [lo, hi) change one of the words.
+     */
+    template <typename Func, typename LeafFunc>
+    void scan(Key lo, Key hi, Func&& func, LeafFunc&& leafFunc) const {
+        if (lo >= hi) return;
+        const Leaf *leaf;
+        uint64_t ver;
+        retry([&]() { return findLeaf(lo, leaf, ver); });
+
+        Key keys[NR_LEAF_KEYS];
+        Value values[NR_LEAF_KEYS];
+        for (;;) {
+            size_t n = 0;
+            bool hasNext;
+            const Leaf *next;
+            for (;;) {
+                n = 0;
+                const size_t count = leaf->safeCount(NR_LEAF_KEYS);
+                for (size_t i = leaf->lowerBound(lo); i < count && leaf->keys[i] < hi; i++) {
+                    keys[n] = leaf->keys[i];
+                    values[n] = leaf->values[i];
+                    n++;
+                }
+                hasNext = count == 0 || leaf->keys[count - 1] < hi;
+                next = __atomic_load_n(&leaf->next, __ATOMIC_ACQUIRE);
+                if (leaf->check(ver)) break;
+                // The leaf has been modified. Keys moved by a split are in the new next leaf.
+                while (!leaf->readLock(ver)) _mm_pause();
+            }
+            leafFunc(leaf->version, ver);
+            for (size_t i = 0; i < n; i++) {
+                if (!func(keys[i], values[i])) return;
+            }
+            if (!hasNext || next == nullptr) return;
+            if (n > 0) {
+                if (keys[n - 1] == hi - 1) return;
+                lo = keys[n - 1] + 1; // not to put the same key twice.
+            }
+            leaf = next;
+            while (!leaf->readLock(ver)) _mm_pause();
+        }
+    }
+
+private:
+    template <typename Func>
+    static bool retry(Func&& func) {
+        for (;;) {
+            const Ret ret = func();
+            if (ret != Ret::RESTART) return ret == Ret::OK;
+            _mm_pause();
+        }
+    }
+    Node *loadRoot() const {
+        return __atomic_load_n(&root_, __ATOMIC_ACQUIRE);
+    }
+    /**
+     * Find the leaf that may have the key with its version.
+     */
+    Ret findLeaf(Key key, const Leaf*& leaf, uint64_t& ver) const {
+        const Node *node = loadRoot();
+        if (!node->readLock(ver)) return Ret::RESTART;
+        if (node != loadRoot()) return Ret::RESTART;
+        while (!node->isLeaf) {
+            const Inner *inner = static_cast<const Inner *>(node);
+            const Node *child = inner->children[inner->lowerBound(key)];
+            if (!inner->check(ver)) return Ret::RESTART;
+            uint64_t childVer;
+            if (!child->readLock(childVer)) return Ret::RESTART;
+            if (!inner->check(ver)) return Ret::RESTART;
+            node = child;
+            ver = childVer;
+        }
+        leaf = static_cast<const Leaf *>(node);
+        return Ret::OK;
+    }
+    Ret tryLookup(Key key, Value& value) const {
+        const Leaf *leaf;
+        uint64_t ver;
+        const Ret ret = findLeaf(key, leaf, ver);
+        if (ret != Ret::OK) return ret;
+        const size_t pos = leaf->lowerBound(key);
+        const bool found = pos < leaf->safeCount(NR_LEAF_KEYS) && leaf->keys[pos] == key;
+        if (found) value = leaf->values[pos];
+        if (!leaf->check(ver)) return Ret::RESTART;
+        return found ? Ret::OK : Ret::FAILED;
+    }
+    /**
+     * Split the node and insert the separator to the parent.
+     * node and parent must be read-locked with ver and parentVer.
+     * RETURN:
+     *   always RESTART since the caller must find the target again.
+     */
+    template <typename NodeT>
+    Ret splitNode(NodeT *node, uint64_t ver, Inner *parent, uint64_t parentVer) {
+        if (parent != nullptr && !parent->tryUpgrade(parentVer)) return Ret::RESTART;
+        if (!node->tryUpgrade(ver)) {
+            if (parent != nullptr) parent->unlock();
+            return Ret::RESTART;
+        }
+        if (parent == nullptr && node != loadRoot()) {
+            // Another thread has made a new root.
+            node->unlock();
+            return Ret::RESTART;
+        }
+        Key sep;
+        Node *right = node->split(sep);
+        if (parent != nullptr) {
+            parent->insert(sep, right);
+        } else {
+            Inner *root = new Inner();
+            root->count = 1;
+            root->keys[0] = sep;
+            root->children[0] = node;
+            root->children[1] = right;
+            __atomic_store_n(&root_, root, __ATOMIC_RELEASE);
+        }
+        node->unlock();
+        if (parent != nullptr) parent->unlock();
+        return Ret::RESTART;
+    }
+    /**
+     * Find the leaf to modify. Full nodes on the path are split.
+     * The leaf is write-locked if OK is returned.
+     */
+    Ret lockLeaf(Key key, Leaf*& leaf, bool splitFull) {
+        Node *node = loadRoot();
+        uint64_t ver;
+        if (!node->readLock(ver)) return Ret::RESTART;
+        if (node != loadRoot()) return Ret::RESTART;
+        Inner *parent = nullptr;
+        uint64_t parentVer = 0;
+        while (!node->isLeaf) {
+            Inner *inner = static_cast<Inner *>(node);
+            if (splitFull && inner->isFull()) return splitNode(inner, ver, parent, parentVer);
+            if (parent != nullptr && !parent->check(parentVer)) return Ret::RESTART;
+            parent = inner;
+            parentVer = ver;
+            node = inner->children[inner->lowerBound(key)];
+            if (!inner->check(ver)) return Ret::RESTART;
+            if (!node->readLock(ver)) return Ret::RESTART;
+        }
+        leaf = static_cast<Leaf *>(node);
+        if (splitFull && leaf->isFull()) return splitNode(leaf, ver, parent, parentVer);
+        if (!leaf->tryUpgrade(ver)) return Ret::RESTART;
+        if (parent != nullptr && !parent->check(parentVer)) {
+            leaf->unlock();
+            return Ret::RESTART;
+        }
+        return Ret::OK;
+    }
+    Ret tryInsert(Key key, Value value) {
+        Leaf *leaf;
+        const Ret ret = lockLeaf(key, leaf, true);
+        if (ret != Ret::OK) return ret;
+        const size_t pos = leaf->lowerBound(key);
+        if (pos < leaf->count && leaf->keys[pos] == key) {
+            leaf->unlock();
+            return Ret::FAILED;
+        }
+        std::copy_backward(&leaf->keys[pos], &leaf->keys[leaf->count], &leaf->keys[leaf->count + 1]);
+        std::copy_backward(&leaf->values[pos], &leaf->values[leaf->count], &leaf->values[leaf->count + 1]);
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        leaf->count++;
+        leaf->unlock();
+        return Ret::OK;
+    }
+    /**
+     * Leaves are not merged even if they become empty.
+     */
+    Ret tryErase(Key key, Value& value) {
+        Leaf *leaf;
+        const Ret ret = lockLeaf(key, leaf, false);
+        if (ret != Ret::OK) return ret;
+        const size_t pos = leaf->lowerBound(key);
+        if (pos >= leaf->count || leaf->keys[pos] != key) {
+            leaf->unlock();
+            return Ret::FAILED;
+        }
+        value = leaf->values[pos];
+        std::copy(&leaf->keys[pos + 1], &leaf->keys[leaf->count], &leaf->keys[pos]);
+        std::copy(&leaf->values[pos + 1], &leaf->values[leaf->count], &leaf->values[pos]);
+        leaf->count--;
+        leaf->unlock();
+        return Ret::OK;
+    }
+    static void freeNode(Node *node) {
+        if (node->isLeaf) {
+            delete static_cast<Leaf *>(node);
+            return;
+        }
+        Inner *inner = static_cast<Inner *>(node);
+        for (size_t i = 0; i <= inner->count; i++) {
+            freeNode(inner->children[i]);
+        }
+        delete inner;
+    }
+};
+
+}} // namespace cybozu::index
@@ -0,0 +1,284 @@
+#pragma once
+/**
+ * @file
+ * @brief Deterministic batch execution like Calvin [Thomson et al. 2012] and BOHM [Faleiro and Abadi 2015].
+ *
+ * A sequencer collects transactions with pre-declared read/write sets into batches.
+ * The lock request queue of each record is built in the batch order
+ * and compiled into dependencies between the transactions:
+ * a reader waits for the previous writer and a writer waits for the previous readers or writer.
+ * Workers take the transactions of a batch in the order and run them
+ * when their dependency counts become zero, so no transaction aborts.
+ * A batch starts after the previous one finishes, while the sequencer fills the next batches.
+ */
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <immintrin.h>
+#include "cybozu/exception.hpp"
+
+
+namespace cybozu {
+namespace calvin {
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+
+struct Access
+{
+    uint64_t key;
+    bool isWrite;
+};
+
+
+class Batch
+{
+    friend class Sequencer;
+    friend class BatchQueue;
+
+    struct Tx
+    {
+        uint32_t accBegin;
+        uint32_t accEnd;
+        uint32_t succBegin;
+        uint32_t succEnd;
+        uint32_t nrDeps; // transactions to wait for.
+    };
+
+    std::vector<Tx> txV_;
+    std::vector<Access> accV_;
+    std::vector<uint32_t> succV_; // successors of each transaction.
+
+    alignas(CACHE_LINE_SIZE) uint64_t seq_; // published sequence number.
+    alignas(CACHE_LINE_SIZE) size_t nextIdx_; // next transaction to take.
+    alignas(CACHE_LINE_SIZE) size_t nrDone_;
+    alignas(CACHE_LINE_SIZE) size_t nrLeft_; // workers that left the batch.
+
+public:
+    Batch() : txV_(), accV_(), succV_(), seq_(UINT64_MAX), nextIdx_(0), nrDone_(0), nrLeft_(0) {}
+
+    /**
+     * The accesses are sorted by key and merged, so a record is accessed once.
+     */
+    template <typename Iterator>
+    void addTx(Iterator begin, Iterator end) {
+        const size_t accBegin = accV_.size();
+        accV_.insert(accV_.end(), begin, end);
+        std::sort(accV_.begin() + accBegin, accV_.end(), [](const Access& a, const Access& b) {
+                return a.key < b.key;
+            });
+        size_t j = accBegin;
+        for (size_t i = accBegin; i < accV_.size(); i++) {
+            if (j > accBegin && accV_[j - 1].key == accV_[i].key) {
+                accV_[j - 1].isWrite |= accV_[i].isWrite;
+            } else {
+                accV_[j++] = accV_[i];
+            }
+        }
+        accV_.resize(j);
+        txV_.push_back(Tx{uint32_t(accBegin), uint32_t(j), 0, 0, 0});
+    }
+    size_t size() const { return txV_.size(); }
+
+    /**
+     * RETURN:
+     *   index of the transaction to run. size() or more means no transaction is left.
+     */
+    size_t take() {
+        return __atomic_fetch_add(&nextIdx_, 1, __ATOMIC_RELAXED);
+    }
+    /**
+     * RETURN:
+     *   false if quit.
+     */
+    bool waitForDeps(size_t idx, const bool& quit) {
+        const uint32_t& nrDeps = txV_[idx].nrDeps;
+        while (__atomic_load_n(&nrDeps, __ATOMIC_ACQUIRE) != 0) {
+            if (__atomic_load_n(&quit, __ATOMIC_RELAXED)) return false;
+            _mm_pause();
+        }
+        return true;
+    }
+    const Access* accBegin(size_t idx) const { return accV_.data() + txV_[idx].accBegin; }
+    const Access* accEnd(size_t idx) const { return accV_.data() + txV_[idx].accEnd; }
+    /**
+     * Call this after running the transaction.
+     */
+    void finish(size_t idx) {
+        const Tx& tx = txV_[idx];
+        for (uint32_t i = tx.succBegin; i < tx.succEnd; i++) {
+            __atomic_fetch_sub(&txV_[succV_[i]].nrDeps, 1, __ATOMIC_RELEASE);
+        }
+        __atomic_fetch_add(&nrDone_, 1, __ATOMIC_RELEASE);
+    }
+    /**
+     * Wait for the other workers to finish the batch.
+     * RETURN:
+     *   false if quit.
+     */
+    bool waitForAll(const bool& quit) {
+        while (__atomic_load_n(&nrDone_, __ATOMIC_ACQUIRE) < txV_.size()) {
+            if (__atomic_load_n(&quit, __ATOMIC_RELAXED)) return false;
+            _mm_pause();
+        }
+        return true;
+    }
+
+private:
+    void clear() {
+        txV_.clear();
+        accV_.clear();
+        succV_.clear();
+        nextIdx_ = 0;
+        nrDone_ = 0;
+    }
+};
+
+
+/**
+ * Per-record lock request queues of the sequencer.
+ * Only the last writer and the readers after it are kept since the others are
+ * reachable through the dependencies.
+ */
+class Sequencer
+{
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Reader
+    {
+        uint32_t txIdx;
+        uint32_t next;
+    };
+
+    std::vector<uint64_t> stamp_; // the entries below are valid if it equals seq_.
+    std::vector<uint32_t> lastWriter_;
+    std::vector<uint32_t> readerHead_;
+    std::vector<Reader> readerV_;
+    std::vector<std::pair<uint32_t, uint32_t> > edgeV_; // (predecessor, successor).
+    uint64_t seq_; // number of built batches.
+
+public:
+    explicit Sequencer(size_t nrRec)
+        : stamp_(nrRec, 0), lastWriter_(nrRec), readerHead_(nrRec)
+        , readerV_(), edgeV_(), seq_(0) {
+    }
+    /**
+     * Build the lock request queues in the batch order and put the dependencies to the batch.
+     */
+    void build(Batch& batch) {
+        seq_++;
+        readerV_.clear();
+        edgeV_.clear();
+        for (size_t t = 0; t < batch.txV_.size(); t++) {
+            const Batch::Tx& tx = batch.txV_[t];
+            for (uint32_t i = tx.accBegin; i < tx.accEnd; i++) {
+                const Access& acc = batch.accV_[i];
+                if (acc.key >= stamp_.size()) {
+                    throw cybozu::Exception("calvin::Sequencer::build: bad key") << acc.key;
+                }
+                enqueue(acc.key, t, acc.isWrite);
+            }
+        }
+        // Compile the edges into successor lists.
+        std::vector<Batch::Tx>& txV = batch.txV_;
+        for (const std::pair<uint32_t, uint32_t>& e : edgeV_) {
+            txV[e.first].succEnd++;
+            txV[e.second].nrDeps++;
+        }
+        uint32_t off = 0;
+        for (Batch::Tx& tx : txV) {
+            tx.succBegin = off;
+            off += tx.succEnd;
+            tx.succEnd = tx.succBegin;
+        }
+        batch.succV_.resize(off);
+        for (const std::pair<uint32_t, uint32_t>& e : edgeV_) {
+            batch.succV_[txV[e.first].succEnd++] = e.second;
+        }
+    }
+
+private:
+    void enqueue(size_t key, uint32_t txIdx, bool isWrite) {
+        if (stamp_[key] != seq_) {
+            stamp_[key] = seq_;
+            lastWriter_[key] = NONE;
+            readerHead_[key] = NONE;
+        }
+        if (isWrite) {
+            if (readerHead_[key] != NONE) {
+                for (uint32_t r = readerHead_[key]; r != NONE; r = readerV_[r].next) {
+                    edgeV_.emplace_back(readerV_[r].txIdx, txIdx);
+                }
+                readerHead_[key] = NONE;
+            } else if (lastWriter_[key] != NONE) {
+                edgeV_.emplace_back(lastWriter_[key], txIdx);
+            }
+            lastWriter_[key] = txIdx;
+        } else {
+            if (lastWriter_[key] != NONE) {
+                edgeV_.emplace_back(lastWriter_[key], txIdx);
+            }
+            readerV_.push_back(Reader{txIdx, readerHead_[key]});
+            readerHead_[key] = readerV_.size() - 1;
+        }
+    }
+};
+
+
+/**
+ * Ring of batches from the sequencer to the workers.
+ * A slot is reused after all the workers left it.
+ */
+class BatchQueue
+{
+    std::vector<Batch> ringV_;
+    size_t nrWorkers_;
+
+public:
+    BatchQueue(size_t nrBatches, size_t nrWorkers) : ringV_(nrBatches), nrWorkers_(nrWorkers) {
+        if (nrBatches == 0 || nrWorkers == 0) {
+            throw cybozu::Exception("calvin::BatchQueue: bad param") << nrBatches << nrWorkers;
+        }
+        for (Batch& b : ringV_) b.nrLeft_ = nrWorkers_;
+    }
+    /**
+     * Sequencer: get the slot to fill.
+     * RETURN:
+     *   nullptr if quit.
+     */
+    Batch* beginFill(uint64_t seq, const bool& quit) {
+        Batch& b = ringV_[seq % ringV_.size()];
+        while (__atomic_load_n(&b.nrLeft_, __ATOMIC_ACQUIRE) < nrWorkers_) {
+            if (__atomic_load_n(&quit, __ATOMIC_RELAXED)) return nullptr;
+            _mm_pause();
+        }
+        b.clear();
+        b.nrLeft_ = 0;
+        return &b;
+    }
+    void publish(Batch& b, uint64_t seq) {
+        __atomic_store_n(&b.seq_, seq, __ATOMIC_RELEASE);
+    }
+    /**
+     * Worker: get the batch of the sequence number.
+     * RETURN:
+     *   nullptr if quit.
+     */
+    Batch* get(uint64_t seq, const bool& quit) {
+        Batch& b = ringV_[seq % ringV_.size()];
+        while (__atomic_load_n(&b.seq_, __ATOMIC_ACQUIRE) != seq) {
+            if (__atomic_load_n(&quit, __ATOMIC_RELAXED)) return nullptr;
+            _mm_pause();
+        }
+        return &b;
+    }
+    /**
+     * Worker: call this after Batch::waitForAll().
+     */
+    void leave(Batch& b) {
+        __atomic_fetch_add(&b.nrLeft_, 1, __ATOMIC_RELEASE);
+    }
+};
+
+}} // namespace cybozu::calvin
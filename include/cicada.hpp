@@ -0,0 +1,525 @@
+#pragma once
+/**
+ * @file
+ * @brief an optimistic multi-version concurrency control method like Cicada.
+ *
+ * Lim et al. Cicada: dependably fast multi-core in-memory transactions. SIGMOD 2017.
+ *
+ * Simplified in the following points:
+ *   - a pending version is installed only at the head of the version list.
+ *   - garbage versions are collected by the writers of the records
+ *     and reclaimed through cybozu::epoch::EpochManager.
+ *   - a version has a 64-bit value as its data.
+ */
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <immintrin.h>
+#include "cybozu/exception.hpp"
+#include "epoch.hpp"
+#include "time.hpp"
+
+
+namespace cybozu {
+namespace cicada {
+
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t TID_BITS = 8; // lower bits of a timestamp are the thread id.
+constexpr size_t MAX_NR_THREADS = size_t(1) << TID_BITS;
+
+
+enum class Status : uint8_t { PENDING = 0, COMMITTED, ABORTED, };
+
+
+struct Version
+{
+    uint64_t wts;
+    uint64_t rts;
+    Version *next; // older version.
+    Status status;
+    bool isInlined;
+    uint64_t value;
+
+    Version() : wts(0), rts(0), next(nullptr), status(Status::COMMITTED), isInlined(false), value(0) {}
+    Status loadStatus() const { return __atomic_load_n(&status, __ATOMIC_ACQUIRE); }
+    void setStatus(Status st) { __atomic_store_n(&status, st, __ATOMIC_RELEASE); }
+    Version *loadNext() const { return __atomic_load_n(&next, __ATOMIC_ACQUIRE); }
+    uint64_t loadRts() const { return __atomic_load_n(&rts, __ATOMIC_RELAXED); }
+    void updateRts(uint64_t ts) {
+        uint64_t v = loadRts();
+        while (v < ts) {
+            if (__atomic_compare_exchange_n(&rts, &v, ts, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+    }
+};
+
+
+/**
+ * A record with its version list.
+ * The latest version is inlined in the record if the inlined space is free.
+ */
+struct Record
+{
+#ifdef MUTEX_ON_CACHELINE
+    alignas(CACHE_LINE_SIZE)
+#endif
+    Version *head;
+    bool inlinedFree;
+    bool gcLock;
+    Version inlined;
+
+    Record() : head(&inlined), inlinedFree(false), gcLock(false), inlined() {
+        inlined.isInlined = true;
+    }
+    ~Record() noexcept {
+        Version *v = head;
+        while (v != nullptr) {
+            Version *next = v->next;
+            if (!v->isInlined) delete v;
+            v = next;
+        }
+    }
+    Record(const Record&) = delete;
+    Record& operator=(const Record&) = delete;
+
+    Version *loadHead() const { return __atomic_load_n(&head, __ATOMIC_ACQUIRE); }
+};
+
+
+/**
+ * Loosely synchronized clocks of the workers and the minimum read timestamp.
+ * The minimum read timestamp is derived only from read-write transactions
+ * so that read-only ones do not pin it.
+ */
+class TimestampManager
+{
+    struct alignas(CACHE_LINE_SIZE) Local
+    {
+        uint64_t clock; // in TSC ticks.
+        /*
+         * Lower bound of the current and future read-write timestamps of the worker.
+         * It is always finite so that updateMinRts() never passes a worker
+         * that is going to take a timestamp.
+         */
+        uint64_t wts;
+        uint64_t rts; // snapshot of the current or last read-only transaction. UINT64_MAX if none.
+        Local() : clock(0), wts(0), rts(UINT64_MAX) {}
+    };
+
+    alignas(CACHE_LINE_SIZE)
+    uint64_t minRts_; // all the current and future read-write timestamps are >= this.
+    std::vector<Local> localV_;
+
+public:
+    TimestampManager() : minRts_(1), localV_() {}
+    void init(size_t nrTh) {
+        if (nrTh > MAX_NR_THREADS) {
+            throw cybozu::Exception("cicada::TimestampManager: too many threads") << nrTh;
+        }
+        minRts_ = 1;
+        localV_.clear();
+        localV_.resize(nrTh);
+    }
+    size_t nrThreads() const { return localV_.size(); }
+    /**
+     * boost: added to the clock to avoid repeated aborts.
+     * RETURN:
+     *   timestamp of a read-write transaction, unique among the workers.
+     */
+    uint64_t beginReadWrite(size_t idx, uint64_t boost) {
+        Local& local = announceLowerBound(idx, &Local::wts);
+        __atomic_store_n(&local.rts, UINT64_MAX, __ATOMIC_RELAXED);
+        uint64_t clock = std::max(local.clock + 1, cybozu::time::rdtsc() + boost);
+        const uint64_t min = __atomic_load_n(&minRts_, __ATOMIC_ACQUIRE);
+        clock = std::max(clock, (min >> TID_BITS) + 1);
+        __atomic_store_n(&local.clock, clock, __ATOMIC_RELAXED);
+        const uint64_t ts = (clock << TID_BITS) | idx;
+        __atomic_store_n(&local.wts, ts, __ATOMIC_RELAXED);
+        return ts;
+    }
+    /**
+     * Read-only transactions read at the minimum read timestamp
+     * where no one will write.
+     * The snapshot is announced only to gcTs().
+     */
+    uint64_t beginReadOnly(size_t idx) {
+        Local& local = announceLowerBound(idx, &Local::rts);
+        // The next read-write clock will be > local.clock.
+        __atomic_store_n(&local.wts, (local.clock + 1) << TID_BITS, __ATOMIC_RELAXED);
+        const uint64_t ts = __atomic_load_n(&minRts_, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&local.rts, ts, __ATOMIC_RELAXED);
+        return ts;
+    }
+    /**
+     * One-sided synchronization of the clock with another worker.
+     */
+    void sync(size_t idx, size_t other) {
+        Local& local = localV_[idx];
+        const uint64_t clock = __atomic_load_n(&localV_[other].clock, __ATOMIC_RELAXED);
+        if (clock > local.clock) __atomic_store_n(&local.clock, clock, __ATOMIC_RELAXED);
+    }
+    void updateMinRts() {
+        uint64_t min = UINT64_MAX;
+        for (const Local& local : localV_) {
+            min = std::min(min, __atomic_load_n(&local.wts, __ATOMIC_RELAXED));
+        }
+        uint64_t cur = __atomic_load_n(&minRts_, __ATOMIC_RELAXED);
+        while (cur < min) {
+            if (__atomic_compare_exchange_n(&minRts_, &cur, min, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) break;
+        }
+    }
+    /**
+     * All the current and future timestamps are >= the return value.
+     */
+    uint64_t gcTs() const {
+        uint64_t min = __atomic_load_n(&minRts_, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (const Local& local : localV_) {
+            min = std::min(min, __atomic_load_n(&local.wts, __ATOMIC_RELAXED));
+            min = std::min(min, __atomic_load_n(&local.rts, __ATOMIC_RELAXED));
+        }
+        return min;
+    }
+
+private:
+    /**
+     * Announce a lower bound before taking a timestamp
+     * so that gcTs() does not miss the transaction.
+     */
+    Local& announceLowerBound(size_t idx, uint64_t Local::*ts) {
+        Local& local = localV_[idx];
+        __atomic_store_n(&(local.*ts), __atomic_load_n(&minRts_, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        return local;
+    }
+};
+
+
+class LocalSet
+{
+    static constexpr size_t SYNC_INTERVAL = 64; // transactions to synchronize clocks.
+    static constexpr size_t GC_INTERVAL = 64; // commits to update gcTs_.
+    static constexpr uint64_t CLOCK_BOOST = 1000; // ticks added per abort.
+
+    struct ReadEntry
+    {
+        Record *rec;
+        Version *ver;
+    };
+    struct WriteEntry
+    {
+        Record *rec;
+        uint64_t value;
+        Version *ver; // pending version installed at commit.
+        uint64_t contention; // wts of the latest version when written.
+    };
+    using ReadSet = std::vector<ReadEntry>;
+    using WriteSet = std::vector<WriteEntry>;
+    using Index = std::unordered_map<uintptr_t, size_t>;
+
+    TimestampManager& tsm_;
+    cybozu::epoch::EpochManager& ebr_;
+    const size_t idx_;
+    uint64_t ts_;
+    bool isReadOnly_;
+    bool inEpoch_;
+    uint64_t boost_;
+    size_t nrBegin_;
+    size_t nrCommit_;
+    uint64_t gcTs_;
+    ReadSet rs_;
+    WriteSet ws_;
+    Index ridx_;
+    Index widx_;
+
+public:
+    /**
+     * idx: worker index, used for tsm and ebr.
+     */
+    LocalSet(TimestampManager& tsm, cybozu::epoch::EpochManager& ebr, size_t idx)
+        : tsm_(tsm), ebr_(ebr), idx_(idx), ts_(0), isReadOnly_(false), inEpoch_(false)
+        , boost_(0), nrBegin_(0), nrCommit_(0), gcTs_(0)
+        , rs_(), ws_(), ridx_(), widx_() {
+    }
+    ~LocalSet() noexcept {
+        if (inEpoch_) abort();
+    }
+    /**
+     * Call this before each trial.
+     * isReadOnly: the transaction will not write. It never aborts.
+     */
+    void begin(bool isReadOnly) {
+        assert(!inEpoch_);
+        assert(rs_.empty() && ws_.empty());
+        if (++nrBegin_ % SYNC_INTERVAL == 0) {
+            tsm_.sync(idx_, nrBegin_ / SYNC_INTERVAL % tsm_.nrThreads());
+            tsm_.updateMinRts();
+        }
+        ebr_.enter(idx_);
+        inEpoch_ = true;
+        isReadOnly_ = isReadOnly;
+        ts_ = isReadOnly ? tsm_.beginReadOnly(idx_) : tsm_.beginReadWrite(idx_, boost_);
+    }
+    /**
+     * RETURN:
+     *   false if the transaction must abort.
+     */
+    bool read(Record& rec, uint64_t& value) {
+        assert(inEpoch_);
+        if (isReadOnly_) {
+            Version *ver = findVisible(rec);
+#ifndef NDEBUG
+            rs_.push_back(ReadEntry{&rec, ver}); // for the snapshot check in preCommit().
+#endif
+            value = ver->value;
+            return true;
+        }
+        WriteSet::iterator wit = findInWriteSet(uintptr_t(&rec));
+        if (wit != ws_.end()) {
+            value = wit->value;
+            return true;
+        }
+        ReadSet::iterator rit = findInReadSet(uintptr_t(&rec));
+        if (rit != rs_.end()) {
+            value = rit->ver->value;
+            return true;
+        }
+        Version *ver = findVisible(rec);
+        rs_.push_back(ReadEntry{&rec, ver});
+        value = ver->value;
+        return true;
+    }
+    /**
+     * RETURN:
+     *   false if the transaction must abort.
+     */
+    bool write(Record& rec, uint64_t value) {
+        assert(inEpoch_);
+        assert(!isReadOnly_);
+        WriteSet::iterator it = findInWriteSet(uintptr_t(&rec));
+        if (it != ws_.end()) {
+            it->value = value;
+            return true;
+        }
+        // Best-effort early abort. The checks in preCommit() would fail.
+        const Version *latest = findLatest(rec);
+        if (latest->wts > ts_) return false;
+        if (findVisible(rec)->loadRts() > ts_) return false;
+        ws_.push_back(WriteEntry{&rec, value, nullptr, latest->wts});
+        return true;
+    }
+    /**
+     * RETURN:
+     *   true if committed. Otherwise call abort().
+     */
+    bool preCommit() {
+        assert(inEpoch_);
+        if (isReadOnly_) {
+#ifndef NDEBUG
+            // No version below ts_ may appear after the snapshot was read.
+            for (const ReadEntry& r : rs_) {
+                if (findVisible(*r.rec) != r.ver) {
+                    throw cybozu::Exception("cicada::LocalSet: read-only snapshot changed") << ts_;
+                }
+            }
+#endif
+            finish();
+            return true;
+        }
+        // Contention-aware validation: records written recently first.
+        std::sort(ws_.begin(), ws_.end(), [](const WriteEntry& a, const WriteEntry& b) {
+                return a.contention > b.contention;
+            });
+        widx_.clear();
+
+        // Install pending versions.
+        for (WriteEntry& w : ws_) {
+            if (!installPending(w)) return false;
+        }
+        // Update read timestamps.
+        for (ReadEntry& r : rs_) {
+            r.ver->updateRts(ts_);
+        }
+        // Check the versions read are still visible.
+        for (const ReadEntry& r : rs_) {
+            if (findVisible(*r.rec) != r.ver) return false;
+        }
+        // Check nobody read the versions overwritten after ts_.
+        for (const WriteEntry& w : ws_) {
+            if (findVisible(*w.rec, w.ver->loadNext())->loadRts() > ts_) return false;
+        }
+        // Commit.
+        for (WriteEntry& w : ws_) {
+            w.ver->setStatus(Status::COMMITTED);
+        }
+        if (nrCommit_++ % GC_INTERVAL == 0) gcTs_ = tsm_.gcTs();
+        for (WriteEntry& w : ws_) {
+            collectGarbage(*w.rec);
+        }
+        boost_ = 0;
+        finish();
+        return true;
+    }
+    /**
+     * Call this after any of read(), write() and preCommit() failed.
+     */
+    void abort() {
+        for (WriteEntry& w : ws_) {
+            if (w.ver == nullptr) continue;
+            w.ver->setStatus(Status::ABORTED);
+            Version *ver = w.ver;
+            if (__atomic_compare_exchange_n(&w.rec->head, &ver, ver->next, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                retire(*w.rec, w.ver);
+            }
+            // Otherwise it will be collected as garbage later.
+        }
+        boost_ += CLOCK_BOOST;
+        finish();
+    }
+    uint64_t timestamp() const { return ts_; }
+
+private:
+    /**
+     * The latest committed version with wts < ts_ at or after ver.
+     */
+    Version *findVisible(Record& rec, Version *ver = nullptr) const {
+        Version *v = ver != nullptr ? ver : rec.loadHead();
+        for (;;) {
+            assert(v != nullptr);
+            if (v->wts < ts_) {
+                Status st;
+                while ((st = v->loadStatus()) == Status::PENDING) _mm_pause();
+                if (st == Status::COMMITTED) return v;
+            }
+            v = v->loadNext();
+        }
+    }
+    /**
+     * The latest version that is not aborted.
+     * Versions except aborted ones are ordered by wts in a list.
+     */
+    static Version *findLatest(Record& rec) {
+        Version *v = rec.loadHead();
+        while (v->loadStatus() == Status::ABORTED) v = v->loadNext();
+        return v;
+    }
+    bool installPending(WriteEntry& w) {
+        Record& rec = *w.rec;
+        Version *ver = allocVersion(rec);
+        ver->wts = ts_;
+        ver->rts = ts_;
+        ver->status = Status::PENDING;
+        ver->value = w.value;
+        for (;;) {
+            Version *head = rec.loadHead();
+            Version *latest = head;
+            while (latest->loadStatus() == Status::ABORTED) latest = latest->loadNext();
+            if (latest->wts > ts_) {
+                freeVersion(rec, ver);
+                return false;
+            }
+            ver->next = head;
+            if (__atomic_compare_exchange_n(&rec.head, &head, ver, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) break;
+        }
+        w.ver = ver;
+        return true;
+    }
+    /**
+     * Keep the latest committed version with wts < gcTs_ and newer ones.
+     * All the versions older than a committed one have been resolved.
+     */
+    void collectGarbage(Record& rec) {
+        if (__atomic_exchange_n(&rec.gcLock, true, __ATOMIC_ACQUIRE)) return;
+        Version *v = rec.loadHead();
+        while (v != nullptr && !(v->wts < gcTs_ && v->loadStatus() == Status::COMMITTED)) {
+            v = v->loadNext();
+        }
+        if (v != nullptr) {
+            Version *old = v->next;
+            __atomic_store_n(&v->next, nullptr, __ATOMIC_RELEASE);
+            while (old != nullptr) {
+                Version *next = old->next;
+                retire(rec, old); // readers may be traversing it.
+                old = next;
+            }
+        }
+        __atomic_store_n(&rec.gcLock, false, __ATOMIC_RELEASE);
+    }
+    static Version *allocVersion(Record& rec) {
+        bool expected = true;
+        if (__atomic_load_n(&rec.inlinedFree, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&rec.inlinedFree, &expected, false, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return &rec.inlined;
+        }
+        Version *ver = new Version();
+        ver->isInlined = false;
+        return ver;
+    }
+    /**
+     * For a version that has never been shared.
+     */
+    static void freeVersion(Record& rec, Version *ver) {
+        if (ver->isInlined) {
+            __atomic_store_n(&rec.inlinedFree, true, __ATOMIC_RELEASE);
+        } else {
+            delete ver;
+        }
+    }
+    void retire(Record& rec, Version *ver) {
+        if (ver->isInlined) {
+            ebr_.retire(idx_, [](void *ctx, uintptr_t) {
+                    __atomic_store_n(&static_cast<Record *>(ctx)->inlinedFree, true, __ATOMIC_RELEASE);
+                }, &rec, 0, sizeof(Version));
+        } else {
+            ebr_.retire(idx_, ver);
+        }
+    }
+    void finish() {
+        rs_.clear();
+        ws_.clear();
+        ridx_.clear();
+        widx_.clear();
+        ebr_.leave(idx_);
+        inEpoch_ = false;
+    }
+    ReadSet::iterator findInReadSet(uintptr_t key) {
+        return findInSet(
+            key, rs_, ridx_,
+            [](const ReadEntry& r) { return uintptr_t(r.rec); });
+    }
+    WriteSet::iterator findInWriteSet(uintptr_t key) {
+        return findInSet(
+            key, ws_, widx_,
+            [](const WriteEntry& w) { return uintptr_t(w.rec); });
+    }
+    template <typename Vector, typename Map, typename Func>
+    typename Vector::iterator findInSet(uintptr_t key, Vector& vec, Map& map, Func&& func) {
+        if (shouldUseIndex(vec)) {
+            for (size_t i = map.size(); i < vec.size(); i++) {
+                map[func(vec[i])] = i;
+            }
+            typename Map::iterator it = map.find(key);
+            if (it == map.end()) {
+                return vec.end();
+            } else {
+                size_t idx = it->second;
+                return vec.begin() + idx;
+            }
+        }
+        return std::find_if(
+            vec.begin(), vec.end(),
+            [&](const typename Vector::value_type& v) {
+                return func(v) == key;
+            });
+    }
+    template <typename Vector>
+    bool shouldUseIndex(const Vector& vec) const {
+        const size_t threshold = 2048 * 2 / sizeof(typename Vector::value_type);
+        return vec.size() > threshold;
+    }
+};
+
+}} // namespace cybozu::cicada
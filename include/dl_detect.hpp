@@ -0,0 +1,451 @@
+#pragma once
+/**
+ * @file
+ * @brief 2PL waiting for locks with deadlock detection by a wait-for graph.
+ *
+ * Each mutex keeps the list of its holders under a latch.
+ * A blocked transaction puts edges to the holders in its slot of the graph
+ * and refreshes them while waiting. Cycles are detected by the blocked transaction
+ * (ON_BLOCK) or by a background thread (PERIODIC),
+ * and the youngest transaction of a cycle is chosen as the victim.
+ */
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <immintrin.h>
+#include "lock.hpp"
+#include "lock_data.hpp"
+#include "cybozu/exception.hpp"
+
+
+namespace cybozu {
+namespace dl_detect {
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+using Latch = cybozu::lock::TtasSpinlockT<false>;
+using Mode = cybozu::lock::LockStateXS::Mode;
+
+
+enum class DetectMode : uint8_t
+{
+    ON_BLOCK = 0, // the blocked transaction detects when its edges change.
+    PERIODIC, // a PeriodicDetector thread detects.
+};
+
+
+class WaitForGraph
+{
+public:
+    static constexpr size_t MAX_NR_SLOTS = 1024;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot
+    {
+        Latch::Mutex latch; // protects the following except victimWaitId.
+        bool waiting;
+        uint64_t txId; // smaller is older.
+        uint64_t waitId; // incremented at each wait.
+        std::vector<uint32_t> edges; // slots of the holders waited for.
+        uint64_t victimWaitId; // the wait of this id must abort.
+
+        Slot() : latch(), waiting(false), txId(0), waitId(0), edges(), victimWaitId(0) {}
+    };
+    struct Node
+    {
+        uint32_t slot;
+        uint64_t txId;
+        uint64_t waitId;
+        size_t next; // in edgeV of the next edge to visit.
+        size_t end;
+    };
+
+    std::vector<Slot> slotV_;
+    DetectMode mode_;
+    uint32_t nrSlots_; // the largest registered slot + 1.
+
+public:
+    WaitForGraph() : slotV_(MAX_NR_SLOTS), mode_(DetectMode::ON_BLOCK), nrSlots_(0) {}
+    WaitForGraph(const WaitForGraph&) = delete;
+    WaitForGraph& operator=(const WaitForGraph&) = delete;
+
+    /**
+     * Call this before running workers.
+     */
+    void setMode(DetectMode mode) { mode_ = mode; }
+    DetectMode mode() const { return mode_; }
+
+    void registerSlot(size_t slot) {
+        if (slot >= MAX_NR_SLOTS) {
+            throw cybozu::Exception("dl_detect::WaitForGraph: too large slot") << slot;
+        }
+        uint32_t n = __atomic_load_n(&nrSlots_, __ATOMIC_RELAXED);
+        while (n < slot + 1) {
+            if (__atomic_compare_exchange_n(&nrSlots_, &n, uint32_t(slot + 1), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+    }
+    void beginWait(size_t slot, uint64_t txId, const std::vector<uint32_t>& edges) {
+        Slot& s = slotV_[slot];
+        Latch lk(&s.latch);
+        s.waiting = true;
+        s.txId = txId;
+        s.waitId++;
+        s.edges = edges;
+    }
+    void updateEdges(size_t slot, const std::vector<uint32_t>& edges) {
+        Slot& s = slotV_[slot];
+        Latch lk(&s.latch);
+        assert(s.waiting);
+        s.edges = edges;
+    }
+    void endWait(size_t slot) {
+        Slot& s = slotV_[slot];
+        Latch lk(&s.latch);
+        s.waiting = false;
+        s.edges.clear();
+    }
+    /**
+     * Call this while waiting.
+     */
+    bool isVictim(size_t slot) const {
+        const Slot& s = slotV_[slot];
+        return __atomic_load_n(&s.victimWaitId, __ATOMIC_ACQUIRE) == s.waitId;
+    }
+    /**
+     * Search a cycle through the slot and mark the youngest transaction in it.
+     * Edges may be stale, so a cycle may be found where no deadlock exists.
+     * RETURN:
+     *   true if a cycle has been found.
+     */
+    bool detect(size_t start) {
+        thread_local std::vector<Node> path;
+        thread_local std::vector<uint32_t> edgeV; // copied edges of the nodes in path.
+        thread_local std::vector<uint8_t> visited;
+        const size_t n = __atomic_load_n(&nrSlots_, __ATOMIC_RELAXED);
+        path.clear();
+        edgeV.clear();
+        visited.assign(n, 0);
+
+        if (!push(start, path, edgeV)) return false;
+        visited[start] = 1;
+        while (!path.empty()) {
+            Node& top = path.back();
+            if (top.next == top.end) {
+                path.pop_back();
+                continue;
+            }
+            const uint32_t v = edgeV[top.next++];
+            if (v == start) {
+                markVictim(path);
+                return true;
+            }
+            if (v >= n || visited[v]) continue;
+            visited[v] = 1;
+            push(v, path, edgeV);
+        }
+        return false;
+    }
+    /**
+     * Detect cycles through every waiting slot.
+     */
+    void detectAll() {
+        const size_t n = __atomic_load_n(&nrSlots_, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < n; i++) {
+            if (__atomic_load_n(&slotV_[i].waiting, __ATOMIC_RELAXED)) detect(i);
+        }
+    }
+
+private:
+    /**
+     * RETURN:
+     *   false if the slot is not waiting.
+     */
+    bool push(size_t slot, std::vector<Node>& path, std::vector<uint32_t>& edgeV) {
+        Slot& s = slotV_[slot];
+        Latch lk(&s.latch);
+        if (!s.waiting) return false;
+        const size_t begin = edgeV.size();
+        edgeV.insert(edgeV.end(), s.edges.begin(), s.edges.end());
+        path.push_back(Node{uint32_t(slot), s.txId, s.waitId, begin, edgeV.size()});
+        return true;
+    }
+    void markVictim(const std::vector<Node>& path) {
+        const Node& victim = *std::max_element(
+            path.begin(), path.end(),
+            [](const Node& a, const Node& b) { return a.txId < b.txId; });
+        __atomic_store_n(&slotV_[victim.slot].victimWaitId, victim.waitId, __ATOMIC_RELEASE);
+    }
+};
+
+
+inline WaitForGraph& waitForGraph()
+{
+    static WaitForGraph graph;
+    return graph;
+}
+
+
+/**
+ * Background thread to detect deadlocks in waitForGraph() while this object is alive.
+ */
+class PeriodicDetector
+{
+    bool quit_;
+    std::thread th_;
+public:
+    explicit PeriodicDetector(size_t intervalUs = 100) : quit_(false), th_() {
+        th_ = std::thread([this, intervalUs]() {
+                while (!__atomic_load_n(&quit_, __ATOMIC_RELAXED)) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+                    waitForGraph().detectAll();
+                }
+            });
+    }
+    ~PeriodicDetector() noexcept {
+        __atomic_store_n(&quit_, true, __ATOMIC_RELAXED);
+        th_.join();
+    }
+    PeriodicDetector(const PeriodicDetector&) = delete;
+    PeriodicDetector& operator=(const PeriodicDetector&) = delete;
+};
+
+
+class DlDetectLock;
+
+struct Mutex
+{
+#ifdef MUTEX_ON_CACHELINE
+    alignas(CACHE_LINE_SIZE)
+#endif
+    Latch::Mutex latch; // protects the following.
+    int32_t state; // -1: X locked, 0: free, n > 0: n S holders.
+    DlDetectLock *holders; // list of the holders.
+
+    Mutex() : latch(), state(0), holders(nullptr) {}
+};
+
+
+/**
+ * A lock object is linked to the holder list of the mutex, so it must not move.
+ */
+class DlDetectLock
+{
+    static constexpr size_t REFRESH_INTERVAL = 64; // spins to check the mutex again.
+
+    Mutex *mutex_;
+    Mode mode_;
+    uint32_t slot_;
+    DlDetectLock *next_; // in the holder list.
+
+public:
+    DlDetectLock() : mutex_(nullptr), mode_(Mode::INVALID), slot_(0), next_(nullptr) {}
+    ~DlDetectLock() noexcept {
+        unlock();
+    }
+    DlDetectLock(const DlDetectLock&) = delete;
+    DlDetectLock& operator=(const DlDetectLock&) = delete;
+
+    /**
+     * If false, the transaction has been chosen as a victim and must abort.
+     */
+    bool lock(Mutex *mutex, Mode mode, uint32_t slot, uint64_t txId) {
+        assert(!mutex_);
+        mutex_ = mutex;
+        mode_ = mode;
+        slot_ = slot;
+        if (!waitFor(txId, [&]() { return mode_ == Mode::S ? mutex_->state >= 0 : mutex_->state == 0; },
+                     [&]() {
+                         mutex_->state = mode_ == Mode::S ? mutex_->state + 1 : -1;
+                         next_ = mutex_->holders;
+                         mutex_->holders = this;
+                     })) {
+            init();
+            return false;
+        }
+        return true;
+    }
+    void unlock() noexcept {
+        if (!mutex_) return;
+        {
+            Latch lk(&mutex_->latch);
+            assert(mode_ == Mode::S ? mutex_->state > 0 : mutex_->state == -1);
+            mutex_->state = mode_ == Mode::S ? mutex_->state - 1 : 0;
+            DlDetectLock **pp = &mutex_->holders;
+            while (*pp != this) {
+                assert(*pp != nullptr);
+                pp = &(*pp)->next_;
+            }
+            *pp = next_;
+        }
+        init();
+    }
+    /**
+     * Wait for the other S holders to release.
+     * If false, the transaction has been chosen as a victim and must abort.
+     * The S lock is kept then.
+     */
+    bool upgrade(uint64_t txId) {
+        assert(mutex_);
+        assert(mode_ == Mode::S);
+        if (!waitFor(txId, [&]() { return mutex_->state == 1; }, [&]() { mutex_->state = -1; })) {
+            return false;
+        }
+        mode_ = Mode::X;
+        return true;
+    }
+    Mode mode() const { return mode_; }
+    uintptr_t getMutexId() const { return uintptr_t(mutex_); }
+
+private:
+    void init() {
+        mutex_ = nullptr;
+        mode_ = Mode::INVALID;
+        next_ = nullptr;
+    }
+    /**
+     * canGrant: bool(), grant: void(). They are called under the latch.
+     */
+    template <typename CanGrant, typename Grant>
+    bool waitFor(uint64_t txId, CanGrant&& canGrant, Grant&& grant) {
+        std::vector<uint32_t> edges;
+        {
+            Latch lk(&mutex_->latch);
+            if (canGrant()) {
+                grant();
+                return true;
+            }
+            getHolders(edges);
+        }
+        WaitForGraph& graph = waitForGraph();
+        const bool onBlock = graph.mode() == DetectMode::ON_BLOCK;
+        graph.beginWait(slot_, txId, edges);
+        if (onBlock) graph.detect(slot_);
+        std::vector<uint32_t> edges2;
+        for (size_t i = 1;; i++) {
+            if (graph.isVictim(slot_)) {
+                graph.endWait(slot_);
+                return false;
+            }
+            _mm_pause();
+            if (i % REFRESH_INTERVAL != 0) continue;
+            {
+                Latch lk(&mutex_->latch);
+                if (canGrant()) {
+                    grant();
+                    break;
+                }
+                getHolders(edges2);
+            }
+            if (edges2 != edges) {
+                edges.swap(edges2);
+                graph.updateEdges(slot_, edges);
+                if (onBlock) graph.detect(slot_);
+            }
+        }
+        graph.endWait(slot_);
+        return true;
+    }
+    /**
+     * Call this under the latch.
+     */
+    void getHolders(std::vector<uint32_t>& edges) const {
+        edges.clear();
+        for (const DlDetectLock *p = mutex_->holders; p != nullptr; p = p->next_) {
+            if (p != this) edges.push_back(p->slot_);
+        }
+        std::sort(edges.begin(), edges.end());
+    }
+};
+
+
+class LockSet
+{
+    using LockV = std::deque<DlDetectLock>; // lock objects must not move.
+
+    // key: mutex addr, value: index in the deque.
+    using Index = std::unordered_map<uintptr_t, size_t>;
+
+    LockV lockV_;
+    Index index_;
+
+    uint32_t slot_;
+    uint64_t txId_;
+
+public:
+    /**
+     * slot: unique among the workers like the worker index.
+     */
+    explicit LockSet(size_t slot) : lockV_(), index_(), slot_(slot), txId_() {
+        waitForGraph().registerSlot(slot);
+    }
+    /* call this before read/write. smaller is older. */
+    void setTxId(uint64_t txId) { txId_ = txId; }
+
+    bool lock(Mutex& mutex, Mode mode) {
+        return mode == Mode::S ? read(mutex) : write(mutex);
+    }
+    bool read(Mutex& mutex) {
+        LockV::iterator it = find(uintptr_t(&mutex));
+        if (it != lockV_.end()) {
+            // read shared data.
+            return true;
+        }
+        lockV_.emplace_back();
+        if (!lockV_.back().lock(&mutex, Mode::S, slot_, txId_)) {
+            lockV_.pop_back();
+            return false;
+        }
+        // read shared data.
+        return true;
+    }
+    bool write(Mutex& mutex) {
+        LockV::iterator it = find(uintptr_t(&mutex));
+        if (it != lockV_.end()) {
+            DlDetectLock& lk = *it;
+            if (lk.mode() == Mode::S && !lk.upgrade(txId_)) return false;
+            // write shared data.
+            return true;
+        }
+        lockV_.emplace_back();
+        if (!lockV_.back().lock(&mutex, Mode::X, slot_, txId_)) {
+            lockV_.pop_back();
+            return false;
+        }
+        // write shared data.
+        return true;
+    }
+    void clear() {
+        lockV_.clear(); // unlock.
+        index_.clear();
+    }
+    bool empty() const {
+        return lockV_.empty() && index_.empty();
+    }
+private:
+    LockV::iterator find(uintptr_t key) {
+        const size_t threshold = 4096 / sizeof(DlDetectLock);
+        if (lockV_.size() > threshold) {
+            for (size_t i = index_.size(); i < lockV_.size(); i++) {
+                index_[lockV_[i].getMutexId()] = i;
+            }
+            Index::iterator it = index_.find(key);
+            if (it == index_.end()) {
+                return lockV_.end();
+            } else {
+                size_t idx = it->second;
+                return lockV_.begin() + idx;
+            }
+        }
+        return std::find_if(
+            lockV_.begin(), lockV_.end(),
+            [&](const DlDetectLock& lk) {
+                return lk.getMutexId() == key;
+            });
+    }
+};
+
+}} // namespace cybozu::dl_detect
@@ -0,0 +1,198 @@
+#pragma once
+/**
+ * @file
+ * @brief Epoch-based memory reclamation.
+ *
+ * Workers announce the global epoch while they may touch shared objects.
+ * An object removed from shared structures is retired to the limbo list
+ * of the worker with the epoch of that time,
+ * and reclaimed when every active worker has announced a later epoch.
+ */
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include "cybozu/exception.hpp"
+#include "time.hpp"
+
+
+namespace cybozu {
+namespace epoch {
+
+/**
+ * ReclaimFunc reclaims an object identified by value. ctx is given at retire().
+ */
+using ReclaimFunc = void (*)(void *ctx, uintptr_t value);
+
+
+/**
+ * Statistics of reclamation.
+ */
+struct Stat
+{
+    size_t nrRetired;
+    size_t nrReclaimed;
+    size_t limboBytes; // bytes in limbo lists now.
+    size_t peakLimboBytes; // sum of the peaks of the workers.
+    uint64_t sumLagTsc; // from retire to reclaim.
+    uint64_t maxLagTsc;
+
+    Stat() : nrRetired(0), nrReclaimed(0), limboBytes(0), peakLimboBytes(0), sumLagTsc(0), maxLagTsc(0) {}
+    void operator+=(const Stat& rhs) {
+        nrRetired += rhs.nrRetired;
+        nrReclaimed += rhs.nrReclaimed;
+        limboBytes += rhs.limboBytes;
+        peakLimboBytes += rhs.peakLimboBytes;
+        sumLagTsc += rhs.sumLagTsc;
+        maxLagTsc = std::max(maxLagTsc, rhs.maxLagTsc);
+    }
+};
+
+
+class EpochManager
+{
+public:
+    static constexpr uint64_t IDLE = UINT64_MAX;
+    static constexpr size_t RECLAIM_INTERVAL = 64; // try to reclaim every this number of leave().
+
+private:
+    struct Retired
+    {
+        uint64_t epoch;
+        uint64_t tsc;
+        ReclaimFunc func;
+        void *ctx;
+        uintptr_t value;
+        size_t bytes;
+    };
+    struct alignas(64) Local
+    {
+        uint64_t announced; // IDLE if the worker does not touch shared objects.
+        size_t nrLeave;
+        std::vector<Retired> limbo; // in the order of epoch.
+        Stat stat;
+
+        Local() : announced(IDLE), nrLeave(0), limbo(), stat() {}
+    };
+
+    alignas(64)
+    uint64_t epoch_;
+    std::vector<Local> localV_;
+
+public:
+    explicit EpochManager(size_t nrTh) : epoch_(0), localV_(nrTh) {}
+    ~EpochManager() noexcept {
+        reclaimAll();
+    }
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    size_t nrThreads() const { return localV_.size(); }
+    uint64_t epoch() const { return __atomic_load_n(&epoch_, __ATOMIC_RELAXED); }
+
+    /**
+     * Call this before touching shared objects.
+     */
+    void enter(size_t idx) {
+        Local& local = localV_[idx];
+        assert(local.announced == IDLE);
+        __atomic_store_n(&local.announced, epoch(), __ATOMIC_RELAXED);
+        // The announcement must be visible before loading shared pointers.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    /**
+     * Call this after the last access to shared objects.
+     * Reclamation is tried sometimes.
+     */
+    void leave(size_t idx) {
+        Local& local = localV_[idx];
+        assert(local.announced != IDLE);
+        __atomic_store_n(&local.announced, IDLE, __ATOMIC_RELEASE);
+        if (++local.nrLeave % RECLAIM_INTERVAL == 0) {
+            tryAdvance();
+            reclaim(idx);
+        }
+    }
+    /**
+     * Call this after the object has been unlinked.
+     * bytes: counted as limbo memory.
+     */
+    void retire(size_t idx, ReclaimFunc func, void *ctx, uintptr_t value, size_t bytes) {
+        Local& local = localV_[idx];
+        local.limbo.push_back(Retired{epoch(), cybozu::time::rdtsc(), func, ctx, value, bytes});
+        Stat& st = local.stat;
+        st.nrRetired++;
+        st.limboBytes += bytes;
+        st.peakLimboBytes = std::max(st.peakLimboBytes, st.limboBytes);
+    }
+    template <typename T>
+    void retire(size_t idx, T *p) {
+        retire(idx, [](void *, uintptr_t v) { delete reinterpret_cast<T *>(v); },
+               nullptr, reinterpret_cast<uintptr_t>(p), sizeof(T));
+    }
+    /**
+     * Advance the global epoch if all the active workers have announced it.
+     */
+    void tryAdvance() {
+        uint64_t e = epoch();
+        for (const Local& local : localV_) {
+            const uint64_t a = __atomic_load_n(&local.announced, __ATOMIC_ACQUIRE);
+            if (a != IDLE && a != e) return;
+        }
+        __atomic_compare_exchange_n(&epoch_, &e, e + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    /**
+     * Reclaim objects retired by the worker that nobody can reference.
+     */
+    void reclaim(size_t idx) {
+        const uint64_t minEpoch = minAnnounced();
+        Local& local = localV_[idx];
+        size_t i = 0;
+        const uint64_t now = cybozu::time::rdtsc();
+        while (i < local.limbo.size() && local.limbo[i].epoch < minEpoch) {
+            reclaimOne(local, local.limbo[i], now);
+            i++;
+        }
+        local.limbo.erase(local.limbo.begin(), local.limbo.begin() + i);
+    }
+    /**
+     * Reclaim all the retired objects.
+     * Call this after all the workers have stopped.
+     */
+    void reclaimAll() {
+        const uint64_t now = cybozu::time::rdtsc();
+        for (Local& local : localV_) {
+            assert(local.announced == IDLE);
+            for (const Retired& r : local.limbo) reclaimOne(local, r, now);
+            local.limbo.clear();
+        }
+    }
+    /**
+     * Read this while no worker is running.
+     */
+    Stat stat() const {
+        Stat st;
+        for (const Local& local : localV_) st += local.stat;
+        return st;
+    }
+
+private:
+    uint64_t minAnnounced() const {
+        uint64_t min = IDLE;
+        for (const Local& local : localV_) {
+            min = std::min(min, __atomic_load_n(&local.announced, __ATOMIC_ACQUIRE));
+        }
+        return min;
+    }
+    static void reclaimOne(Local& local, const Retired& r, uint64_t now) {
+        r.func(r.ctx, r.value);
+        Stat& st = local.stat;
+        st.nrReclaimed++;
+        st.limboBytes -= r.bytes;
+        const uint64_t lag = now - r.tsc;
+        st.sumLagTsc += lag;
+        st.maxLagTsc = std::max(st.maxLagTsc, lag);
+    }
+};
+
+}} // namespace cybozu::epoch
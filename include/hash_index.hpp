@@ -0,0 +1,108 @@
+#pragma once
+/**
+ * @file
+ * @brief Concurrent hash index mapping 64-bit keys to slots.
+ *
+ * Open addressing with linear probing.
+ * Lookups are lock-free and inserts use CAS on the key word.
+ * The table size is fixed at init().
+ */
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <immintrin.h>
+#include "cybozu/exception.hpp"
+
+
+namespace cybozu {
+namespace index {
+
+class HashIndex
+{
+public:
+    static constexpr uint64_t EMPTY_KEY = UINT64_MAX; // reserved.
+    static constexpr uint64_t INVALID_VALUE = UINT64_MAX; // reserved.
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t value; // INVALID_VALUE until the inserter sets it.
+    };
+    std::vector<Entry> tbl_;
+    size_t mask_;
+
+public:
+    HashIndex() : tbl_(), mask_(0) {}
+    /**
+     * maxNrKeys: the table has 2 * maxNrKeys entries at least.
+     * Do not call this concurrently with the other member functions.
+     */
+    void init(size_t maxNrKeys) {
+        size_t size = 1;
+        while (size < maxNrKeys * 2) size *= 2;
+        tbl_.assign(size, Entry{EMPTY_KEY, INVALID_VALUE});
+        mask_ = size - 1;
+    }
+    /**
+     * RETURN:
+     *   false if the key already exists.
+     */
+    bool insert(uint64_t key, uint64_t value) {
+        assert(key != EMPTY_KEY);
+        assert(value != INVALID_VALUE);
+        size_t i = hash(key) & mask_;
+        for (size_t n = 0; n < tbl_.size(); n++) {
+            Entry& e = tbl_[i];
+            uint64_t k = __atomic_load_n(&e.key, __ATOMIC_ACQUIRE);
+            if (k == EMPTY_KEY) {
+                if (__atomic_compare_exchange_n(&e.key, &k, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    __atomic_store_n(&e.value, value, __ATOMIC_RELEASE);
+                    return true;
+                }
+                // k is the key inserted by another thread.
+            }
+            if (k == key) return false;
+            i = (i + 1) & mask_;
+        }
+        throw cybozu::Exception("HashIndex::insert: full") << tbl_.size();
+    }
+    /**
+     * RETURN:
+     *   false if the key does not exist.
+     */
+    bool lookup(uint64_t key, uint64_t& value) const {
+        size_t i = hash(key) & mask_;
+        for (size_t n = 0; n < tbl_.size(); n++) {
+            const Entry& e = tbl_[i];
+            const uint64_t k = __atomic_load_n(&e.key, __ATOMIC_ACQUIRE);
+            if (k == key) {
+                uint64_t v;
+                while ((v = __atomic_load_n(&e.value, __ATOMIC_ACQUIRE)) == INVALID_VALUE) {
+                    _mm_pause(); // the inserter is setting the value.
+                }
+                value = v;
+                return true;
+            }
+            if (k == EMPTY_KEY) return false;
+            i = (i + 1) & mask_;
+        }
+        return false;
+    }
+    size_t capacity() const { return tbl_.size(); }
+
+private:
+    /**
+     * The finalizer of MurmurHash3.
+     */
+    static uint64_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+};
+
+}} // namespace cybozu::index
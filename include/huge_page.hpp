@@ -0,0 +1,236 @@
+#pragma once
+/**
+ * @file
+ * @brief Allocation of large arrays backed by huge pages.
+ *
+ * The mode is selected once per process before allocating arrays.
+ * Arrays of at least 2MB are mapped with MAP_HUGETLB of the requested page size,
+ * falling back to 2MB pages, then to transparent huge pages with madvise(MADV_HUGEPAGE),
+ * then to normal pages. obtainedMode() tells the weakest mode actually used.
+ * THP is reported only if the kernel allows it for madvised ranges,
+ * and even then the kernel may not back all the range with huge pages.
+ * Smaller arrays and the 'none' mode use the heap with cache line alignment.
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <type_traits>
+#include <sys/mman.h>
+#include "cybozu/exception.hpp"
+
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+
+namespace cybozu {
+namespace huge_page {
+
+enum class Mode : uint8_t
+{
+    NONE = 0, // heap.
+    THP, // transparent huge pages by madvise(). The kernel may not back all the range.
+    HUGETLB_2M, // 2MB pages by MAP_HUGETLB.
+    HUGETLB_1G, // 1GB pages by MAP_HUGETLB.
+    MAX,
+};
+
+
+inline const char* modeStr(Mode mode)
+{
+    static const char *const tbl[] = {
+        "none", "thp", "2m", "1g",
+    };
+    static_assert(sizeof(tbl) / sizeof(tbl[0]) == size_t(Mode::MAX), "modeStr: bad table size.");
+    return tbl[size_t(mode)];
+}
+
+
+inline Mode parseMode(const std::string& s)
+{
+    for (size_t i = 0; i < size_t(Mode::MAX); i++) {
+        if (s == modeStr(Mode(i))) return Mode(i);
+    }
+    throw cybozu::Exception("huge_page::parseMode: bad mode") << s;
+}
+
+
+namespace local {
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t SIZE_2M = size_t(1) << 21;
+constexpr size_t SIZE_1G = size_t(1) << 30;
+
+struct State
+{
+    Mode requested;
+    Mode obtained; // MAX means no array has been mapped.
+    std::mutex mutex;
+    std::unordered_map<uintptr_t, size_t> mapped; // address to mapped length.
+
+    State() : requested(Mode::NONE), obtained(Mode::MAX), mutex(), mapped() {}
+};
+
+inline State& state()
+{
+    static State st;
+    return st;
+}
+
+inline size_t roundUp(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+/**
+ * madvise(MADV_HUGEPAGE) succeeds even if THP is disabled,
+ * so check the 'always' or 'madvise' setting is selected.
+ */
+inline bool isThpEnabled()
+{
+    static const bool enabled = []() {
+        std::ifstream ifs("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string s;
+        while (ifs >> s) {
+            if (s == "[always]" || s == "[madvise]") return true;
+        }
+        return false;
+    }();
+    return enabled;
+}
+
+/**
+ * shift: log2 of the page size.
+ */
+inline void *mapHugeTlb(size_t len, int shift)
+{
+    void *p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    return p;
+}
+
+/**
+ * RETURN:
+ *   mapped address and its length and mode, or nullptr.
+ */
+inline void *map(size_t size, Mode requested, size_t& len, Mode& obtained)
+{
+    void *p;
+    if (requested == Mode::HUGETLB_1G) {
+        len = roundUp(size, SIZE_1G);
+        p = mapHugeTlb(len, 30);
+        if (p != nullptr) { obtained = Mode::HUGETLB_1G; return p; }
+    }
+    if (requested >= Mode::HUGETLB_2M) {
+        len = roundUp(size, SIZE_2M);
+        p = mapHugeTlb(len, 21);
+        if (p != nullptr) { obtained = Mode::HUGETLB_2M; return p; }
+    }
+    len = roundUp(size, SIZE_2M);
+    p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    obtained = ::madvise(p, len, MADV_HUGEPAGE) == 0 && isThpEnabled() ? Mode::THP : Mode::NONE;
+    return p;
+}
+
+} // namespace local
+
+
+/**
+ * Call this before allocating arrays with Allocator.
+ */
+inline void setMode(Mode mode)
+{
+    local::state().requested = mode;
+}
+inline Mode requestedMode()
+{
+    return local::state().requested;
+}
+/**
+ * The weakest mode of the mapped arrays. NONE if no array has been mapped.
+ */
+inline Mode obtainedMode()
+{
+    local::State& st = local::state();
+    std::lock_guard<std::mutex> lk(st.mutex);
+    return st.obtained == Mode::MAX ? Mode::NONE : st.obtained;
+}
+
+
+inline void *allocate(size_t size, size_t align)
+{
+    local::State& st = local::state();
+    if (st.requested == Mode::NONE || size < local::SIZE_2M) {
+        void *p;
+        if (::posix_memalign(&p, std::max(align, local::CACHE_LINE_SIZE), size) != 0) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    size_t len;
+    Mode obtained;
+    void *p = local::map(size, st.requested, len, obtained);
+    if (p == nullptr) throw std::bad_alloc();
+    std::lock_guard<std::mutex> lk(st.mutex);
+    st.mapped.emplace(uintptr_t(p), len);
+    st.obtained = std::min(st.obtained, obtained);
+    return p;
+}
+
+
+inline void deallocate(void *p)
+{
+    if (p == nullptr) return;
+    local::State& st = local::state();
+    {
+        std::lock_guard<std::mutex> lk(st.mutex);
+        auto it = st.mapped.find(uintptr_t(p));
+        if (it != st.mapped.end()) {
+            ::munmap(p, it->second);
+            st.mapped.erase(it);
+            return;
+        }
+    }
+    ::free(p);
+}
+
+
+template <typename T>
+class Allocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+
+    Allocator() {}
+    template <typename U>
+    Allocator(const Allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(huge_page::allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t) {
+        huge_page::deallocate(p);
+    }
+    template <typename U>
+    bool operator==(const Allocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const Allocator<U>&) const { return false; }
+};
+
+
+/**
+ * Use this for mutex and record arrays.
+ */
+template <typename T>
+using Vector = std::vector<T, Allocator<T>>;
+
+}} // namespace cybozu::huge_page
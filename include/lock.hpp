@@ -403,8 +403,10 @@ class NoWaitLockSet
 
     LockV lockV_;
     Index index_;
+    bool upgradeFailed_; // the last failure is by upgrade or not.
 
 public:
+    NoWaitLockSet() : lockV_(), index_(), upgradeFailed_(false) {}
     bool lock(Mutex& mutex, Mode mode) {
         return mode == Mode::S ? read(mutex) : write(mutex);
     }
@@ -418,6 +420,7 @@ public:
         Lock &lk = lockV_.back();
         if (!lk.tryLock(&mutex, Mode::S)) {
             // should die.
+            upgradeFailed_ = false;
             return false;
         }
         // read shared data.
@@ -428,6 +431,7 @@ public:
         if (it != lockV_.end()) {
             Lock& lk = *it;
             if (lk.mode() == Mode::S && !lk.tryUpgrade()) {
+                upgradeFailed_ = true;
                 return false;
             }
             // write shared data.
@@ -437,6 +441,7 @@ public:
         Lock &lk = lockV_.back();
         if (!lk.tryLock(&mutex, Mode::X)) {
             // should die.
+            upgradeFailed_ = false;
             return false;
         }
         // write shared data.
@@ -449,6 +454,12 @@ public:
     bool empty() const {
         return lockV_.empty() && index_.empty();
     }
+    /**
+     * Call this after lock() failed.
+     */
+    bool isUpgradeFailed() const {
+        return upgradeFailed_;
+    }
 private:
     LockV::iterator find(uintptr_t key) {
         const size_t threshold = 4096 / sizeof(Lock);
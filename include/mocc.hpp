@@ -0,0 +1,312 @@
+#pragma once
+/**
+ * @file
+ * @brief Mostly-optimistic concurrency control (MOCC) [Wang and Kimura 2016].
+ *
+ * Each record has a temperature bumped when its verification fails.
+ * Transactions read cold records optimistically as Silo (occ.hpp)
+ * and take pessimistic reader-writer locks of hot records in the read phase.
+ * Blocking locks are taken only in the canonical (address) order,
+ * and other locks are tried once. The hot records of an aborted transaction are kept
+ * in the retrospective lock list and locked in the canonical order at its retry.
+ *
+ * Committing writers take the pessimistic lock in X mode before the Silo lock,
+ * so pessimistic readers are never invalidated.
+ */
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "occ.hpp"
+#include "lock.hpp"
+
+
+namespace cybozu {
+namespace mocc {
+
+/**
+ * Abort counter in the current epoch of occ::globalEpoch().
+ * It is reset at the first bump in a new epoch, so records cool down.
+ */
+class Temperature
+{
+    uint64_t word_; // epoch (32bits) and count (32bits).
+public:
+    Temperature() : word_(0) {}
+    void bump(uint32_t epoch) {
+        uint64_t w = __atomic_load_n(&word_, __ATOMIC_RELAXED);
+        for (;;) {
+            uint64_t next;
+            if (uint32_t(w >> 32) == epoch) {
+                if (uint32_t(w) == UINT32_MAX) return;
+                next = w + 1;
+            } else {
+                next = (uint64_t(epoch) << 32) | 1;
+            }
+            if (__atomic_compare_exchange_n(&word_, &w, next, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+        }
+    }
+    /**
+     * The counts of the current and the previous epoch are effective.
+     */
+    bool isHot(uint32_t epoch, uint32_t threshold) const {
+        const uint64_t w = __atomic_load_n(&word_, __ATOMIC_RELAXED);
+        return uint32_t(w >> 32) + 1 >= epoch && uint32_t(w) >= threshold;
+    }
+};
+
+
+struct Mutex
+{
+    cybozu::occ::OccMutex occ; // TID word for optimistic reads and commit.
+    cybozu::lock::XSMutex xs; // pessimistic lock.
+    Temperature temp;
+};
+
+
+class LocalSet
+{
+public:
+    using Mode = cybozu::lock::XSMutex::Mode;
+    static constexpr uint32_t HOT_THRESHOLD = 10; // aborts in an epoch.
+
+private:
+    struct ReadEntry
+    {
+        Mutex *mutex;
+        cybozu::occ::OccReader reader;
+    };
+    struct RetroEntry
+    {
+        Mutex *mutex;
+        Mode mode;
+    };
+    using ReadV = std::vector<ReadEntry>;
+    using WriteV = std::vector<Mutex *>;
+    using PLockV = std::vector<cybozu::lock::XSLock>;
+    using IndexM = std::unordered_map<uintptr_t, size_t>;
+
+    ReadV readV_; // read set.
+    IndexM readM_;
+    WriteV writeV_; // write set.
+    IndexM writeM_;
+    PLockV pLockV_; // pessimistic locks.
+    IndexM pLockM_;
+    uintptr_t maxLocked_; // the largest mutex id of pLockV_.
+    std::vector<cybozu::occ::OccLock> occLockV_;
+    std::vector<RetroEntry> retroV_; // retrospective lock list.
+    cybozu::occ::TidGenerator tidGen_;
+    uint32_t epoch_;
+    Mutex *failed_; // whose verification or locking failed.
+
+public:
+    LocalSet()
+        : readV_(), readM_(), writeV_(), writeM_(), pLockV_(), pLockM_(), maxLocked_(0)
+        , occLockV_(), retroV_(), tidGen_(), epoch_(0), failed_(nullptr) {
+    }
+    ~LocalSet() noexcept {
+        clear();
+    }
+    /**
+     * Call this before each trial.
+     * isRetry: lock the records of the retrospective lock list if true.
+     */
+    void begin(bool isRetry) {
+        assert(pLockV_.empty());
+        epoch_ = cybozu::occ::globalEpoch().load();
+        if (isRetry) {
+            // They are sorted, so blocking locks are in the canonical order.
+            for (const RetroEntry& e : retroV_) lockPessimistic(*e.mutex, e.mode);
+        }
+        retroV_.clear();
+    }
+    template <typename Func>
+    void read(Mutex& mutex, Func&& readFunc) {
+        read(mutex, std::forward<Func>(readFunc), Mode::S);
+    }
+    void write(Mutex& mutex) {
+        if (isHot(mutex)) lockPessimistic(mutex, Mode::X);
+        if (findInWriteSet(uintptr_t(&mutex)) != writeV_.end()) {
+            // write local data.
+            return;
+        }
+        writeV_.push_back(&mutex);
+        // write local data.
+    }
+    /**
+     * Read-modify-write. Hot records are locked in X mode from the first.
+     */
+    template <typename Func>
+    void update(Mutex& mutex, Func&& readFunc) {
+        read(mutex, std::forward<Func>(readFunc), Mode::X);
+        write(mutex);
+    }
+    /**
+     * writeFunc: void()
+     *   install the writes. It is called only if the transaction can commit.
+     * RETURN:
+     *   false if the transaction must abort. Call abort() then.
+     */
+    template <typename Func>
+    bool preCommit(Func&& writeFunc) {
+        std::sort(writeV_.begin(), writeV_.end());
+        for (Mutex *mutex : writeV_) {
+            if (!lockPessimistic(*mutex, Mode::X)) {
+                failed_ = mutex;
+                return false;
+            }
+        }
+        // Nobody else takes these since we have the X locks.
+        for (Mutex *mutex : writeV_) {
+            occLockV_.emplace_back(&mutex->occ);
+        }
+        // Serialization point.
+        __atomic_thread_fence(__ATOMIC_ACQ_REL);
+        const uint32_t epoch = cybozu::occ::globalEpoch().load();
+
+        for (const ReadEntry& e : readV_) {
+            const bool inWriteSet = std::binary_search(writeV_.begin(), writeV_.end(), e.mutex);
+            const bool valid = inWriteSet ? e.reader.verifyVersion() : e.reader.verifyAll();
+            if (!valid) {
+                failed_ = e.mutex;
+                return false;
+            }
+        }
+        writeFunc();
+        for (const ReadEntry& e : readV_) tidGen_.observe(e.reader.getTid());
+        for (const cybozu::occ::OccLock& lk : occLockV_) tidGen_.observe(lk.getTid());
+        const uint64_t tid = tidGen_.generate(epoch);
+        for (cybozu::occ::OccLock& lk : occLockV_) {
+            lk.update(tid);
+        }
+        clear();
+        return true;
+    }
+    /**
+     * Bump the temperature of the failed record and
+     * keep the hot records accessed in the retrospective lock list.
+     */
+    void abort() {
+        if (failed_ != nullptr) failed_->temp.bump(epoch_);
+        retroV_.clear();
+        for (const ReadEntry& e : readV_) {
+            if (isHot(*e.mutex)) retroV_.push_back(RetroEntry{e.mutex, Mode::S});
+        }
+        for (Mutex *mutex : writeV_) {
+            if (isHot(*mutex)) retroV_.push_back(RetroEntry{mutex, Mode::X});
+        }
+        std::sort(retroV_.begin(), retroV_.end(), [](const RetroEntry& a, const RetroEntry& b) {
+                if (a.mutex != b.mutex) return a.mutex < b.mutex;
+                return a.mode == Mode::X && b.mode != Mode::X; // X first.
+            });
+        retroV_.erase(std::unique(retroV_.begin(), retroV_.end(), [](const RetroEntry& a, const RetroEntry& b) {
+                    return a.mutex == b.mutex;
+                }), retroV_.end());
+        clear();
+    }
+    bool empty() const {
+        return readV_.empty() && writeV_.empty() && pLockV_.empty() && occLockV_.empty();
+    }
+
+private:
+    bool isHot(const Mutex& mutex) const {
+        return mutex.temp.isHot(epoch_, HOT_THRESHOLD);
+    }
+    template <typename Func>
+    void read(Mutex& mutex, Func&& readFunc, Mode mode) {
+        if (findInReadSet(uintptr_t(&mutex)) != readV_.end()) {
+            // read local data.
+            return;
+        }
+        if (isHot(mutex)) lockPessimistic(mutex, mode);
+        readV_.push_back(ReadEntry{&mutex, cybozu::occ::OccReader()});
+        cybozu::occ::OccReader& r = readV_.back().reader;
+        for (;;) {
+            r.prepare(&mutex.occ);
+            readFunc();
+            r.readFence();
+            if (r.verifyAll()) break;
+        }
+    }
+    /**
+     * Blocking lock in the canonical order, otherwise try-lock.
+     * S to X upgrade is also tried only once.
+     * RETURN:
+     *   false if the lock has not been taken in the mode.
+     */
+    bool lockPessimistic(Mutex& mutex, Mode mode) {
+        const uintptr_t id = uintptr_t(&mutex.xs);
+        PLockV::iterator it = findInPLockSet(id);
+        if (it != pLockV_.end()) {
+            if (mode == Mode::X && it->isShared()) return it->tryUpgrade();
+            return true;
+        }
+        pLockV_.emplace_back();
+        cybozu::lock::XSLock& lk = pLockV_.back();
+        if (id > maxLocked_) {
+            lk.lock(&mutex.xs, mode);
+            maxLocked_ = id;
+            return true;
+        }
+        if (lk.tryLock(&mutex.xs, mode)) return true;
+        pLockV_.pop_back();
+        return false;
+    }
+    void clear() {
+        occLockV_.clear(); // unlock.
+        pLockV_.clear(); // unlock.
+        pLockM_.clear();
+        maxLocked_ = 0;
+        readV_.clear();
+        readM_.clear();
+        writeV_.clear();
+        writeM_.clear();
+        failed_ = nullptr;
+    }
+    ReadV::iterator findInReadSet(uintptr_t key) {
+        return findInSet(
+            key, readV_, readM_,
+            [](const ReadEntry& e) { return uintptr_t(e.mutex); });
+    }
+    WriteV::iterator findInWriteSet(uintptr_t key) {
+        return findInSet(
+            key, writeV_, writeM_,
+            [](const Mutex *mutex) { return uintptr_t(mutex); });
+    }
+    PLockV::iterator findInPLockSet(uintptr_t key) {
+        return findInSet(
+            key, pLockV_, pLockM_,
+            [](const cybozu::lock::XSLock& lk) { return lk.getMutexId(); });
+    }
+    /**
+     * func: uintptr_t(const Vector::value_type&)
+     */
+    template <typename Vector, typename Map, typename Func>
+    typename Vector::iterator findInSet(uintptr_t key, Vector& vec, Map& map, Func&& func) {
+        if (shouldUseIndex(vec)) {
+            // create indexes.
+            for (size_t i = map.size(); i < vec.size(); i++) {
+                map[func(vec[i])] = i;
+            }
+            // use indexes.
+            typename Map::iterator it = map.find(key);
+            if (it == map.end()) {
+                return vec.end();
+            } else {
+                size_t idx = it->second;
+                return vec.begin() + idx;
+            }
+        }
+        return std::find_if(
+            vec.begin(), vec.end(),
+            [&](const typename Vector::value_type& v) {
+                return func(v) == key;
+            });
+    }
+    template <typename Vector>
+    bool shouldUseIndex(const Vector& vec) const {
+        const size_t threshold = 2048 * 2 / sizeof(typename Vector::value_type);
+        return vec.size() > threshold;
+    }
+};
+
+}} // namespace cybozu::mocc
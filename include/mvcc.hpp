@@ -0,0 +1,172 @@
+#pragma once
+/**
+ * @file
+ * @brief Version chains of records for snapshot reads.
+ *
+ * Updaters keep using their concurrency control and install a version
+ * of each written record with a commit timestamp while they hold its lock.
+ * Read-only transactions read the versions of a snapshot
+ * without locks nor validation.
+ *
+ * The clock is incremented only when a snapshot begins.
+ * An updater takes the clock as its timestamp after locking its write set
+ * and before verifying its read set, so the versions with timestamps
+ * up to a snapshot are of the transactions serialized before it.
+ * Readers must wait for the record to be unlocked before finding the version,
+ * since an updater of the snapshot may not have installed it yet.
+ */
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <immintrin.h>
+#include "epoch.hpp"
+
+
+namespace cybozu {
+namespace mvcc {
+
+struct Version
+{
+    uint64_t ts; // commit timestamp.
+    Version *next; // older version.
+    uint64_t value;
+};
+
+
+class VersionStore
+{
+public:
+    static constexpr uint64_t NO_SNAPSHOT = UINT64_MAX;
+
+private:
+    struct alignas(64) Snapshot
+    {
+        uint64_t ts; // NO_SNAPSHOT if the worker does not read a snapshot.
+        Snapshot() : ts(NO_SNAPSHOT) {}
+    };
+
+    alignas(64)
+    uint64_t clock_;
+    std::vector<Version *> headV_; // the newest version of each record.
+    std::vector<Snapshot> snapV_; // for each worker.
+
+public:
+    VersionStore() : clock_(1), headV_(), snapV_() {}
+    ~VersionStore() noexcept {
+        destroy();
+    }
+    VersionStore(const VersionStore&) = delete;
+    VersionStore& operator=(const VersionStore&) = delete;
+
+    /**
+     * Each record has a version of value 0.
+     */
+    void init(size_t nrRec, size_t nrTh) {
+        destroy();
+        headV_.resize(nrRec);
+        for (Version*& head : headV_) head = new Version{0, nullptr, 0};
+        snapV_.clear();
+        snapV_.resize(nrTh);
+    }
+    size_t size() const { return headV_.size(); }
+
+    /*
+     * For updaters.
+     */
+
+    /**
+     * The newest version. It may be replaced concurrently.
+     * Enter an epoch of EpochManager before calling this.
+     */
+    const Version& newest(size_t i) const {
+        return *__atomic_load_n(&headV_[i], __ATOMIC_ACQUIRE);
+    }
+    /**
+     * Call this after locking the write set and before verifying the read set.
+     */
+    uint64_t commitTs() const {
+        return __atomic_load_n(&clock_, __ATOMIC_ACQUIRE);
+    }
+    /**
+     * Call this while holding the lock of the record.
+     * Versions that no snapshot needs are retired to ebr.
+     * gcTs: returned by gcTs() some time ago.
+     */
+    void install(size_t i, uint64_t ts, uint64_t value, uint64_t gcTs,
+                 cybozu::epoch::EpochManager& ebr, size_t idx) {
+        Version *v = new Version{ts, headV_[i], value};
+        __atomic_store_n(&headV_[i], v, __ATOMIC_RELEASE);
+
+        // Keep the newest version visible from gcTs.
+        while (v->ts > gcTs && v->next != nullptr) v = v->next;
+        Version *old = v->next;
+        if (old == nullptr) return;
+        __atomic_store_n(&v->next, nullptr, __ATOMIC_RELAXED);
+        while (old != nullptr) {
+            Version *next = old->next;
+            ebr.retire(idx, old); // readers may be traversing it.
+            old = next;
+        }
+    }
+    /**
+     * All the current and future snapshots have timestamps >= the return value.
+     */
+    uint64_t gcTs() const {
+        uint64_t min = __atomic_load_n(&clock_, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (const Snapshot& snap : snapV_) {
+            min = std::min(min, __atomic_load_n(&snap.ts, __ATOMIC_RELAXED));
+        }
+        return min;
+    }
+
+    /*
+     * For snapshot readers.
+     */
+
+    /**
+     * Enter an epoch of EpochManager before calling this.
+     * RETURN:
+     *   snapshot timestamp.
+     */
+    uint64_t beginSnapshot(size_t idx) {
+        Snapshot& snap = snapV_[idx];
+        assert(snap.ts == NO_SNAPSHOT);
+        // Announce a lower bound first so that gcTs() does not miss this.
+        __atomic_store_n(&snap.ts, __atomic_load_n(&clock_, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        const uint64_t ts = __atomic_fetch_add(&clock_, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&snap.ts, ts, __ATOMIC_RELAXED);
+        return ts;
+    }
+    void endSnapshot(size_t idx) {
+        __atomic_store_n(&snapV_[idx].ts, NO_SNAPSHOT, __ATOMIC_RELEASE);
+    }
+    /**
+     * The newest version with timestamp <= ts.
+     * Call this after observing the record unlocked.
+     */
+    const Version& find(size_t i, uint64_t ts) const {
+        const Version *v = __atomic_load_n(&headV_[i], __ATOMIC_ACQUIRE);
+        while (v->ts > ts) {
+            v = __atomic_load_n(&v->next, __ATOMIC_ACQUIRE);
+            assert(v != nullptr);
+        }
+        return *v;
+    }
+
+private:
+    void destroy() {
+        for (Version *v : headV_) {
+            while (v != nullptr) {
+                Version *next = v->next;
+                delete v;
+                v = next;
+            }
+        }
+        headV_.clear();
+    }
+};
+
+}} // namespace cybozu::mvcc
@@ -7,6 +7,9 @@
  * (C) 2016 Cybozu Labs, Inc.
  */
 #include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 #include <immintrin.h>
 #include <unordered_map>
 #include "lock.hpp"
@@ -20,43 +23,136 @@ namespace occ {
 
 constexpr size_t CACHE_LINE_SIZE = 64;
 
+/**
+ * Global epoch of Silo [Tu et al. 2013].
+ * EpochAdvancer increments it periodically.
+ * Commit TIDs of a transaction are in the epoch read at its serialization point.
+ */
+class GlobalEpoch
+{
+    alignas(CACHE_LINE_SIZE)
+    uint32_t epoch_;
+public:
+    GlobalEpoch() : epoch_(1) {}
+    uint32_t load() const {
+        return __atomic_load_n(&epoch_, __ATOMIC_ACQUIRE);
+    }
+    void advance() {
+        __atomic_fetch_add(&epoch_, 1, __ATOMIC_RELEASE);
+    }
+};
+
+
+inline GlobalEpoch& globalEpoch()
+{
+    static GlobalEpoch epoch;
+    return epoch;
+}
+
+
+/**
+ * Background thread to advance globalEpoch() while this object is alive.
+ */
+class EpochAdvancer
+{
+    bool quit_;
+    std::thread th_;
+public:
+    explicit EpochAdvancer(size_t intervalMs = 40) : quit_(false), th_() {
+        th_ = std::thread([this, intervalMs]() {
+                while (!__atomic_load_n(&quit_, __ATOMIC_RELAXED)) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+                    globalEpoch().advance();
+                }
+            });
+    }
+    ~EpochAdvancer() noexcept {
+        __atomic_store_n(&quit_, true, __ATOMIC_RELAXED);
+        th_.join();
+    }
+    EpochAdvancer(const EpochAdvancer&) = delete;
+    EpochAdvancer& operator=(const EpochAdvancer&) = delete;
+};
+
+
+/**
+ * TID: epoch (30bits) and sequence in the epoch (32bits).
+ * 0 means the record has never been written.
+ */
+constexpr uint64_t makeTid(uint32_t epoch, uint32_t seq)
+{
+    return (uint64_t(epoch) << 32) | seq;
+}
+constexpr uint32_t tidEpoch(uint64_t tid)
+{
+    return uint32_t(tid >> 32);
+}
+
+
+/**
+ * Commit TIDs of a worker.
+ * A TID is larger than the TIDs of the records read or written by the transaction,
+ * larger than the last TID of the worker, and in the given epoch.
+ * So TIDs of conflicting transactions are in their serial order.
+ */
+class TidGenerator
+{
+    uint64_t maxTid_; // of the records observed by the current transaction.
+    uint64_t lastTid_;
+public:
+    TidGenerator() : maxTid_(0), lastTid_(0) {}
+    void observe(uint64_t tid) {
+        maxTid_ = std::max(maxTid_, tid);
+    }
+    /**
+     * Call this after verification succeeded.
+     * epoch: read at the serialization point.
+     */
+    uint64_t generate(uint32_t epoch) {
+        const uint64_t tid = std::max(std::max(maxTid_, lastTid_) + 1, makeTid(epoch, 0));
+        lastTid_ = tid;
+        maxTid_ = 0;
+        return tid;
+    }
+    void clear() {
+        maxTid_ = 0;
+    }
+    uint64_t lastTid() const { return lastTid_; }
+};
+
+
 struct OccLockData
 {
     /*
-     * 0-30(31bits) record version
-     * 31(1bit) X lock flag.
+     * 0-61(62bits) TID of the last writer.
+     * 62(1bit) absent flag. The record has not been inserted or has been deleted.
+     * 63(1bit) X lock flag.
+     * The TID is set by every update, so it never goes back like a wrapping counter.
      */
-    uint32_t obj;
-    static constexpr uint32_t mask = (0x1 << 31);
+    uint64_t obj;
+    static constexpr uint64_t mask = (uint64_t(1) << 63);
+    static constexpr uint64_t absentMask = (uint64_t(1) << 62);
+    static constexpr uint64_t tidMask = absentMask - 1;
 
     OccLockData() : obj(0) {}
     OccLockData load() const {
-        uint32_t x = __atomic_load_n(&obj, __ATOMIC_RELAXED);
+        uint64_t x = __atomic_load_n(&obj, __ATOMIC_RELAXED);
         OccLockData *lockD = reinterpret_cast<OccLockData*>(&x);
         return *lockD;
     }
     bool compareAndSwap(const OccLockData& before, const OccLockData& after) {
-        return __atomic_compare_exchange(&obj, (uint32_t *)&before, (uint32_t *)&after, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        return __atomic_compare_exchange(&obj, (uint64_t *)&before, (uint64_t *)&after, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
     }
     void set(const OccLockData& after) {
         obj = after.obj;
     }
-    uint32_t getVersion() const {
-        return obj & ~mask;
+    uint64_t getTid() const {
+        return obj & tidMask;
     }
-    void setVersion(uint32_t version) {
-        assert(version < mask);
-        obj &= mask;
-        obj |= version;
-    }
-    void incVersion() {
-        uint32_t v = getVersion();
-        if (v < mask - 1) {
-            v++;
-        } else {
-            v = 0;
-        }
-        setVersion(v);
+    void setTid(uint64_t tid) {
+        assert(tid <= tidMask);
+        obj &= ~tidMask;
+        obj |= tid;
     }
     bool isLocked() const {
         return (obj & mask) != 0;
@@ -67,6 +163,16 @@ struct OccLockData
     void clearLock() {
         obj &= ~mask;
     }
+    bool isAbsent() const {
+        return (obj & absentMask) != 0;
+    }
+    void setAbsent(bool absent) {
+        if (absent) {
+            obj |= absentMask;
+        } else {
+            obj &= ~absentMask;
+        }
+    }
 };
 
 
@@ -90,8 +196,10 @@ private:
     Mutex *mutex_;
     LockData lockD_;
     bool updated_;
+    bool absent_; // absent flag to set at unlock if updated_.
+    uint64_t tid_; // TID to set at unlock if updated_.
 public:
-    OccLock() : mutex_(), lockD_(), updated_(false) {}
+    OccLock() : mutex_(), lockD_(), updated_(false), absent_(false), tid_(0) {}
     explicit OccLock(Mutex *mutex) : OccLock() {
         lock(mutex);
     }
@@ -117,6 +225,7 @@ public:
             if (mutex_->lockD.compareAndSwap(lockD_, lockD)) {
                 lockD_ = lockD;
                 updated_ = false;
+                absent_ = lockD.isAbsent();
                 break;
             }
         }
@@ -126,7 +235,10 @@ public:
 
         LockData lockD = lockD_;
         assert(lockD.isLocked());
-        if (updated_) lockD.incVersion();
+        if (updated_) {
+            lockD.setTid(tid_);
+            lockD.setAbsent(absent_);
+        }
         lockD.clearLock();
 #if 0
         if (!mutex_->lockD.compareAndSwap(lockD_, lockD)) {
@@ -138,8 +250,26 @@ public:
 #endif
         mutex_ = nullptr;
     }
-    void update() {
+    /**
+     * tid: commit TID, larger than getTid().
+     */
+    void update(uint64_t tid) {
+        assert(tid > lockD_.getTid());
         updated_ = true;
+        tid_ = tid;
+    }
+    /**
+     * Insert (absent = false) or delete (absent = true) the record.
+     */
+    void update(uint64_t tid, bool absent) {
+        update(tid);
+        absent_ = absent;
+    }
+    /**
+     * TID of the record when locked.
+     */
+    uint64_t getTid() const {
+        return lockD_.getTid();
     }
     /**
      * Call this just after update the resource.
@@ -154,6 +284,9 @@ private:
     void swap(OccLock& rhs) {
         std::swap(mutex_, rhs.mutex_);
         std::swap(lockD_, rhs.lockD_);
+        std::swap(updated_, rhs.updated_);
+        std::swap(absent_, rhs.absent_);
+        std::swap(tid_, rhs.tid_);
     }
     void waitFor() {
         assert(mutex_);
@@ -206,12 +339,24 @@ public:
     bool verifyAll() const {
         if (!mutex_) throw std::runtime_error("OccReader::verify: mutex_ is null");
         const LockData lockD = mutex_->lockD.load();
-        return !lockD.isLocked() && lockD_.getVersion() == lockD.getVersion();
+        return !lockD.isLocked() && lockD_.getTid() == lockD.getTid();
     }
     bool verifyVersion() const {
         if (!mutex_) throw std::runtime_error("OccReader::verify: mutex_ is null");
         const LockData lockD = mutex_->lockD.load();
-        return lockD_.getVersion() == lockD.getVersion();
+        return lockD_.getTid() == lockD.getTid();
+    }
+    /**
+     * TID of the record read.
+     */
+    uint64_t getTid() const {
+        return lockD_.getTid();
+    }
+    /**
+     * The absent flag of the record read.
+     */
+    bool isAbsent() const {
+        return lockD_.isAbsent();
     }
     uintptr_t getMutexId() const {
         return uintptr_t(mutex_);
@@ -234,28 +379,64 @@ private:
     using ReadV = std::vector<OccReader>;
     using WriteV = std::vector<uintptr_t>; // mutex pointers.
     using IndexM = std::unordered_map<uintptr_t, size_t>;
+    struct NodeVersion
+    {
+        const uint64_t *word;
+        uint64_t version;
+    };
+    using NodeV = std::vector<NodeVersion>;
+    struct AbsentOp
+    {
+        uintptr_t mutex;
+        bool absent; // false: insert, true: delete.
+    };
+    using AbsentV = std::vector<AbsentOp>;
 
     WriteV writeV_; // write set.
     IndexM writeM_; // write set index.
     ReadV readV_; // read set.
     IndexM readM_; // read set index.
+    NodeV nodeV_; // node set.
+    AbsentV absentV_; // inserts and deletes in the write set.
     LockV lockV_;
+    TidGenerator tidGen_;
+    uint32_t epoch_; // read at the serialization point.
+    uint64_t tid_; // commit TID decided by verify().
 
 public:
-    void read(Mutex& mutex) {
+    LockSet()
+        : writeV_(), writeM_(), readV_(), readM_(), nodeV_(), absentV_(), lockV_()
+        , tidGen_(), epoch_(0), tid_(0) {
+    }
+    bool read(Mutex& mutex) {
+        return read(mutex, []() {});
+    }
+    /**
+     * readFunc: void()
+     *   copy shared data to local memory. It may be called several times.
+     *   It will not be called if the mutex is already in the read set.
+     * RETURN:
+     *   false if the record is absent. Its data must not be used then.
+     */
+    template <typename Func>
+    bool read(Mutex& mutex, Func&& readFunc) {
+        for (const AbsentOp& op : absentV_) {
+            if (op.mutex == uintptr_t(&mutex)) return !op.absent;
+        }
         ReadV::iterator it = findInReadSet(uintptr_t(&mutex));
         if (it != readV_.end()) {
             // read local data.
-            return;
+            return !it->isAbsent();
         }
         readV_.emplace_back();
         OccReader& r = readV_.back();
         for (;;) {
             r.prepare(&mutex);
-            // read shared data.
+            readFunc();
             r.readFence();
             if (r.verifyAll()) break;
         }
+        return !r.isAbsent();
     }
     void write(Mutex& mutex) {
         WriteV::iterator it = findInWriteSet(uintptr_t(&mutex));
@@ -266,6 +447,33 @@ public:
         writeV_.push_back(uintptr_t(&mutex));
         // write local data.
     }
+    /**
+     * Insert a record. It will be present at commit.
+     * The mutex must be of an absent record that nobody else inserts,
+     * typically allocated by the transaction.
+     */
+    void insert(Mutex& mutex) {
+        write(mutex);
+        absentV_.push_back(AbsentOp{uintptr_t(&mutex), false});
+    }
+    /**
+     * Delete a record. It will be absent at commit.
+     * The record must have been read as present by the transaction.
+     */
+    void remove(Mutex& mutex) {
+        write(mutex);
+        absentV_.push_back(AbsentOp{uintptr_t(&mutex), true});
+    }
+    /**
+     * Node set for phantom protection [Tu et al. 2013].
+     * Add the version of an index node read by a range scan.
+     * verify() fails if the node has been modified since then.
+     * Index updates of the transaction itself must not modify the nodes
+     * in the node set before verify(), or it fails.
+     */
+    void addNode(const uint64_t& versionWord, uint64_t version) {
+        nodeV_.push_back(NodeVersion{&versionWord, version});
+    }
     void lock() {
         std::sort(writeV_.begin(), writeV_.end());
         for (uintptr_t mutex : writeV_) {
@@ -273,7 +481,12 @@ public:
         }
         // Serialization point.
         __atomic_thread_fence(__ATOMIC_ACQ_REL);
+        epoch_ = globalEpoch().load();
     }
+    /**
+     * Call this after lock().
+     * The commit TID is decided if it succeeds.
+     */
     bool verify() {
         const bool useIndex = shouldUseIndex(writeV_);
         if (!useIndex) {
@@ -290,11 +503,34 @@ public:
             const bool valid = inWriteSet ? r.verifyVersion() : r.verifyAll();
             if (!valid) return false;
         }
+        for (const NodeVersion& n : nodeV_) {
+            if (__atomic_load_n(n.word, __ATOMIC_RELAXED) != n.version) return false;
+        }
+        for (const OccReader& r : readV_) tidGen_.observe(r.getTid());
+        for (const OccLock& lk : lockV_) tidGen_.observe(lk.getTid());
+        tid_ = tidGen_.generate(epoch_);
         return true;
     }
+    /**
+     * The commit TID. Valid after verify() succeeded.
+     * It will be written to the records by updateAndUnlock().
+     */
+    uint64_t commitTid() const {
+        return tid_;
+    }
     void updateAndUnlock() {
         for (OccLock& lk : lockV_) {
-            lk.update();
+            lk.update(tid_);
+        }
+        for (const AbsentOp& op : absentV_) {
+            // lockV_ is sorted by lock().
+            LockV::iterator it = std::lower_bound(
+                lockV_.begin(), lockV_.end(), op.mutex,
+                [](const OccLock& lk, uintptr_t mutex) { return lk.getMutexId() < mutex; });
+            assert(it != lockV_.end() && it->getMutexId() == op.mutex);
+            it->update(tid_, op.absent);
+        }
+        for (OccLock& lk : lockV_) {
             lk.unlock();
         }
         clear();
@@ -303,6 +539,8 @@ public:
         lockV_.clear();
         readV_.clear();
         readM_.clear();
+        nodeV_.clear();
+        absentV_.clear();
         writeV_.clear();
         writeM_.clear();
     }
@@ -310,6 +548,8 @@ public:
         return lockV_.empty() &&
             readV_.empty() &&
             readM_.empty() &&
+            nodeV_.empty() &&
+            absentV_.empty() &&
             writeV_.empty() &&
             writeM_.empty();
     }
@@ -0,0 +1,169 @@
+#pragma once
+/**
+ * @file
+ * @brief hardware performance counters of a thread using perf_event_open().
+ *
+ * Counters are user-space only so that they work with
+ * the default kernel.perf_event_paranoid setting.
+ */
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+namespace cybozu {
+namespace perf {
+
+enum class Event : uint8_t
+{
+    CYCLES = 0,
+    INSTRUCTIONS,
+    LLC_MISSES,
+    RAW, // model-specific event like HITM given by the user.
+    MAX,
+};
+
+constexpr size_t NR_EVENTS = size_t(Event::MAX);
+
+
+inline const char* eventStr(Event ev)
+{
+    static const char *const tbl[] = {
+        "cycles", "instructions", "llcMisses", "raw",
+    };
+    static_assert(sizeof(tbl) / sizeof(tbl[0]) == NR_EVENTS, "eventStr: bad table size.");
+    return tbl[size_t(ev)];
+}
+
+
+struct Counts
+{
+    uint64_t value[NR_EVENTS];
+    bool valid[NR_EVENTS]; // false if the event was not counted by some thread.
+
+    Counts() : value() {
+        for (bool& v : valid) v = true;
+    }
+    void operator+=(const Counts& rhs) {
+        for (size_t i = 0; i < NR_EVENTS; i++) {
+            value[i] += rhs.value[i];
+            valid[i] = valid[i] && rhs.valid[i];
+        }
+    }
+    uint64_t get(Event ev) const { return value[size_t(ev)]; }
+    bool isValid(Event ev) const { return valid[size_t(ev)]; }
+};
+
+
+/**
+ * A counter group of a thread.
+ * open() must be called by the target thread,
+ * while the others can be called by any thread.
+ */
+class CounterGroup
+{
+    int fd_[NR_EVENTS]; // -1 means not available.
+    int leader_; // index of the group leader in fd_. -1 means no counter.
+    int err_; // errno of the first failure.
+
+public:
+    CounterGroup() : leader_(-1), err_(0) {
+        for (int& fd : fd_) fd = -1;
+    }
+    ~CounterGroup() noexcept {
+        close();
+    }
+    CounterGroup(const CounterGroup&) = delete;
+    CounterGroup& operator=(const CounterGroup&) = delete;
+
+    /**
+     * Open the counters of the calling thread. They are disabled at first.
+     * rawConfig: config of Event::RAW. 0 means not used.
+     * Events the PMU does not support are just ignored.
+     * RETURN:
+     *   false if no counter is available.
+     */
+    bool open(uint64_t rawConfig = 0) {
+        close();
+        err_ = 0;
+        const uint64_t hwConfig[] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, // usually last-level cache misses.
+        };
+        for (size_t i = 0; i < NR_EVENTS; i++) {
+            const Event ev = Event(i);
+            if (ev == Event::RAW) {
+                if (rawConfig == 0) continue;
+                openEvent(i, PERF_TYPE_RAW, rawConfig);
+            } else {
+                openEvent(i, PERF_TYPE_HARDWARE, hwConfig[i]);
+            }
+        }
+        return leader_ >= 0;
+    }
+    void close() {
+        for (int& fd : fd_) {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+        leader_ = -1;
+    }
+    bool isAvailable() const { return leader_ >= 0; }
+    int error() const { return err_; }
+
+    void reset() { ioctl(PERF_EVENT_IOC_RESET); }
+    void enable() { ioctl(PERF_EVENT_IOC_ENABLE); }
+    void disable() { ioctl(PERF_EVENT_IOC_DISABLE); }
+
+    /**
+     * Values are scaled if counters were multiplexed.
+     */
+    Counts read() const {
+        Counts c;
+        for (size_t i = 0; i < NR_EVENTS; i++) {
+            c.valid[i] = readEvent(fd_[i], c.value[i]);
+        }
+        return c;
+    }
+private:
+    void openEvent(size_t i, uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        ::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = leader_ < 0; // members follow the leader.
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        const int groupFd = leader_ < 0 ? -1 : fd_[leader_];
+        const int fd = ::syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+        if (fd < 0) {
+            if (err_ == 0) err_ = errno;
+            return;
+        }
+        fd_[i] = fd;
+        if (leader_ < 0) leader_ = i;
+    }
+    void ioctl(unsigned long request) {
+        if (leader_ < 0) return;
+        ::ioctl(fd_[leader_], request, PERF_IOC_FLAG_GROUP);
+    }
+    static bool readEvent(int fd, uint64_t& value) {
+        value = 0;
+        if (fd < 0) return false;
+        uint64_t buf[3]; // value, time enabled, time running.
+        if (::read(fd, buf, sizeof(buf)) != sizeof(buf)) return false;
+        if (buf[2] == 0) return buf[1] == 0; // never scheduled.
+        value = buf[2] < buf[1] ? uint64_t(double(buf[0]) * buf[1] / buf[2]) : buf[0];
+        return true;
+    }
+};
+
+
+}} // namespace cybozu::perf
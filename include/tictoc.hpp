@@ -278,7 +278,8 @@ using Flags = std::vector<bool>; // isInWriteSet array.
  *   true: you must commit.
  *   false: you must abort.
  */
-bool preCommit(ReadSet& rs, WriteSet& ws, LockSet& ls, Flags& flags)
+template <typename Func>
+bool preCommit(ReadSet& rs, WriteSet& ws, LockSet& ls, Flags& flags, Func&& writeFunc)
 {
     bool ret = false;
 
@@ -320,6 +321,7 @@ bool preCommit(ReadSet& rs, WriteSet& ws, LockSet& ls, Flags& flags)
     }
 
     // Write phase.
+    writeFunc();
     for (Lock& lk : ls) {
         // Write.
         lk.updateAndUnlock(commitTs);
@@ -334,6 +336,11 @@ bool preCommit(ReadSet& rs, WriteSet& ws, LockSet& ls, Flags& flags)
     return ret;
 }
 
+inline bool preCommit(ReadSet& rs, WriteSet& ws, LockSet& ls, Flags& flags)
+{
+    return preCommit(rs, ws, ls, flags, []() {});
+}
+
 
 class LocalSet
 {
@@ -348,6 +355,15 @@ class LocalSet
 
 public:
     void read(Mutex& mutex) {
+        read(mutex, []() {});
+    }
+    /**
+     * readFunc: void()
+     *   copy shared data to local memory. It may be called several times.
+     *   It will not be called if the mutex is already in the read set.
+     */
+    template <typename Func>
+    void read(Mutex& mutex, Func&& readFunc) {
         ReadSet::iterator it = findInReadSet(uintptr_t(&mutex));
         if (it != rs_.end()) {
             // read local data.
@@ -357,7 +373,7 @@ public:
         Reader& r = rs_.back();
         r.prepare(&mutex);
         for (;;) {
-            // read shared data.
+            readFunc();
             r.readFence();
             if (r.isReadSucceeded()) break;
             r.prepareRetry();
@@ -373,7 +389,16 @@ public:
         // write local data.
     }
     bool preCommit() {
-        bool ret = cybozu::tictoc::preCommit(rs_, ws_, ls_, flags_);
+        return preCommit([]() {});
+    }
+    /**
+     * writeFunc: void()
+     *   install local data to the shared memory.
+     *   It will be called only if the transaction can commit.
+     */
+    template <typename Func>
+    bool preCommit(Func&& writeFunc) {
+        bool ret = cybozu::tictoc::preCommit(rs_, ws_, ls_, flags_, std::forward<Func>(writeFunc));
         ridx_.clear();
         widx_.clear();
         return ret;
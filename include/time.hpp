@@ -10,6 +10,9 @@
 
 #include <chrono>
 #include <deque>
+#include <thread>
+#include <cstdint>
+#include <x86intrin.h>
 
 namespace cybozu {
 namespace time {
@@ -59,6 +62,33 @@ public:
     }
 };
 
+/**
+ * Read the time stamp counter.
+ */
+inline uint64_t rdtsc()
+{
+    return __rdtsc();
+}
+
+/**
+ * Number of TSC ticks per nanosecond.
+ * It is measured with steady_clock at the first call, which takes about 100ms.
+ */
+inline double tscTicksPerNs()
+{
+    static const double ticksPerNs = []() {
+        using Clock = std::chrono::steady_clock;
+        const Clock::time_point t0 = Clock::now();
+        const uint64_t c0 = rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const Clock::time_point t1 = Clock::now();
+        const uint64_t c1 = rdtsc();
+        const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        return (c1 - c0) / ns;
+    }();
+    return ticksPerNs;
+}
+
 }} // namespace cybozu::time
 
 #endif /* CYBOZU_TIME_HPP */
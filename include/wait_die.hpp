@@ -1,8 +1,11 @@
 #pragma once
 /**
  * 2PL wait and die for deadlock prevension.
+ * Wound-wait is also available with WoundWaitLockSet.
  */
+#include <deque>
 #include <immintrin.h>
+#include "lock.hpp"
 #include "lock_data.hpp"
 
 
@@ -166,10 +169,15 @@ public:
         assert(mutex_);
         assert(mode_ == Mode::S);
         WaitDieData wd0 = mutex_->atomicRead();
-        while (txId_ == wd0.txId && wd0.getLockState()->getCount(Mode::S) == 1) {
+        // We are the only S holder.
+        // wd0.txId is not reliable here because it is not reset at unlock.
+        while (wd0.getLockState()->getCount(Mode::S) == 1) {
             WaitDieData wd1 = wd0;
             wd1.getLockState()->clearAll();
             wd1.getLockState()->set(Mode::X);
+            if (txId_ < wd0.txId) {
+                wd1.txId = txId_;
+            }
             if (mutex_->compareAndSwap(wd0, wd1)) {
                 mode_ = Mode::X;
                 return true;
@@ -207,8 +215,10 @@ private:
 
 class LockSet
 {
+public:
     using Mode = cybozu::lock::LockStateXS::Mode;
     using Mutex = WaitDieLock::Mutex;
+private:
     using LockV = std::vector<WaitDieLock>;
 
     // key: mutex addr, value: index in the vector.
@@ -218,8 +228,10 @@ class LockSet
     Index index_;
 
     TxId txId_;
+    bool upgradeFailed_; // the last failure is by upgrade or not.
 
 public:
+    LockSet() : lockV_(), index_(), txId_(), upgradeFailed_(false) {}
     /* call this before read/write. */
     void setTxId(TxId txId) { txId_ = txId; }
 
@@ -236,6 +248,7 @@ public:
         WaitDieLock &lk = lockV_.back();
         if (!lk.lock(&mutex, Mode::S, txId_)) {
             // should die.
+            upgradeFailed_ = false;
             return false;
         }
         // read shared data.
@@ -246,6 +259,7 @@ public:
         if (it != lockV_.end()) {
             WaitDieLock& lk = *it;
             if (lk.mode() == Mode::S && !lk.upgrade()) {
+                upgradeFailed_ = true;
                 return false;
             }
             // write shared data.
@@ -255,6 +269,7 @@ public:
         WaitDieLock &lk = lockV_.back();
         if (!lk.lock(&mutex, Mode::X, txId_)) {
             // should die.
+            upgradeFailed_ = false;
             return false;
         }
         // write shared data.
@@ -267,6 +282,12 @@ public:
     bool empty() const {
         return lockV_.empty() && index_.empty();
     }
+    /**
+     * Call this after lock() failed.
+     */
+    bool isUpgradeFailed() const {
+        return upgradeFailed_;
+    }
 private:
     LockV::iterator find(uintptr_t key) {
         const size_t threshold = 4096 / sizeof(WaitDieLock);
@@ -291,4 +312,260 @@ private:
 };
 
 
+/**
+ * Per-transaction status word for wound-wait.
+ * Older transactions set WOUNDED of younger holders,
+ * and the owner aborts at its next check point.
+ */
+class TxStatus
+{
+    static constexpr uint32_t WOUNDED = 0x1;
+    alignas(CACHE_LINE_SIZE) uint32_t word_;
+public:
+    TxStatus() : word_(0) {}
+    void reset() { __atomic_store_n(&word_, 0, __ATOMIC_RELAXED); }
+    void wound() { __atomic_fetch_or(&word_, WOUNDED, __ATOMIC_RELAXED); }
+    bool isWounded() const { return (__atomic_load_n(&word_, __ATOMIC_RELAXED) & WOUNDED) != 0; }
+};
+
+
+class WoundWaitLock;
+
+struct WoundWaitMutex
+{
+#ifdef MUTEX_ON_CACHELINE
+    alignas(CACHE_LINE_SIZE)
+#endif
+    cybozu::lock::TtasSpinlockT<false>::Mutex latch; // protects the following.
+    int32_t state; // -1: X locked, 0: free, n > 0: n S holders.
+    WoundWaitLock *holders; // list of the holders to wound.
+
+    WoundWaitMutex() : latch(), state(0), holders(nullptr) {}
+};
+
+
+/**
+ * 2PL wound-wait lock.
+ * A requester wounds the younger holders and waits for all the holders.
+ * A lock object is linked to the holder list of the mutex, so it must not move.
+ */
+class WoundWaitLock
+{
+public:
+    using Mode = cybozu::lock::LockStateXS::Mode;
+    using Mutex = WoundWaitMutex;
+private:
+    using Latch = cybozu::lock::TtasSpinlockT<false>;
+    static constexpr size_t RETRY_INTERVAL = 64; // spins to check the mutex again.
+
+    Mutex *mutex_;
+    Mode mode_;
+    TxId txId_;
+    TxStatus *status_;
+    WoundWaitLock *next_; // in the holder list.
+
+public:
+    WoundWaitLock() : mutex_(nullptr), mode_(Mode::INVALID), txId_(0), status_(nullptr), next_(nullptr) {}
+    ~WoundWaitLock() noexcept {
+        unlock();
+    }
+    WoundWaitLock(const WoundWaitLock&) = delete;
+    WoundWaitLock& operator=(const WoundWaitLock&) = delete;
+
+    /**
+     * If false, the transaction has been wounded and must abort.
+     */
+    bool lock(Mutex *mutex, Mode mode, TxId txId, TxStatus *status) {
+        assert(!mutex_);
+        assert(mutex);
+        mutex_ = mutex;
+        mode_ = mode;
+        txId_ = txId;
+        status_ = status;
+        if (!waitFor([&]() { return mode_ == Mode::S ? mutex_->state >= 0 : mutex_->state == 0; },
+                     [&]() {
+                         mutex_->state = mode_ == Mode::S ? mutex_->state + 1 : -1;
+                         next_ = mutex_->holders;
+                         mutex_->holders = this;
+                     })) {
+            init();
+            return false;
+        }
+        return true;
+    }
+    void unlock() noexcept {
+        if (!mutex_) return;
+        {
+            Latch lk(&mutex_->latch);
+            assert(mode_ == Mode::S ? mutex_->state > 0 : mutex_->state == -1);
+            mutex_->state = mode_ == Mode::S ? mutex_->state - 1 : 0;
+            WoundWaitLock **pp = &mutex_->holders;
+            while (*pp != this) {
+                assert(*pp != nullptr);
+                pp = &(*pp)->next_;
+            }
+            *pp = next_;
+        }
+        init();
+    }
+    /**
+     * Wound the younger S holders and wait for the others to release.
+     * If false, the transaction has been wounded and must abort.
+     * The S lock is kept then.
+     */
+    bool upgrade() {
+        assert(mutex_);
+        assert(mode_ == Mode::S);
+        if (!waitFor([&]() { return mutex_->state == 1; }, [&]() { mutex_->state = -1; })) {
+            return false;
+        }
+        mode_ = Mode::X;
+        return true;
+    }
+    Mode mode() const { return mode_; }
+    uintptr_t getMutexId() const { return uintptr_t(mutex_); }
+
+private:
+    void init() {
+        mutex_ = nullptr;
+        mode_ = Mode::INVALID;
+        txId_ = 0;
+        status_ = nullptr;
+        next_ = nullptr;
+    }
+    /**
+     * canGrant: bool(), grant: void(). They are called under the latch.
+     * The status is checked while waiting because a waiter may be wounded.
+     */
+    template <typename CanGrant, typename Grant>
+    bool waitFor(CanGrant&& canGrant, Grant&& grant) {
+        for (;;) {
+            if (status_->isWounded()) return false;
+            {
+                Latch lk(&mutex_->latch);
+                if (canGrant()) {
+                    grant();
+                    return true;
+                }
+                woundYoungerHolders();
+            }
+            for (size_t i = 0; i < RETRY_INTERVAL; i++) {
+                if (status_->isWounded()) return false;
+                _mm_pause();
+            }
+        }
+    }
+    /**
+     * Call this under the latch.
+     */
+    void woundYoungerHolders() {
+        for (WoundWaitLock *p = mutex_->holders; p != nullptr; p = p->next_) {
+            if (p != this && txId_ < p->txId_) p->status_->wound();
+        }
+    }
+};
+
+
+/**
+ * Lock set for wound-wait. It must not move because its locks refer to its status.
+ */
+class WoundWaitLockSet
+{
+public:
+    using Mode = cybozu::lock::LockStateXS::Mode;
+    using Mutex = WoundWaitLock::Mutex;
+private:
+    using LockV = std::deque<WoundWaitLock>; // lock objects must not move.
+
+    // key: mutex addr, value: index in the deque.
+    using Index = std::unordered_map<uintptr_t, size_t>;
+
+    LockV lockV_;
+    Index index_;
+
+    TxId txId_;
+    TxStatus status_;
+
+public:
+    WoundWaitLockSet() : lockV_(), index_(), txId_(), status_() {}
+    WoundWaitLockSet(const WoundWaitLockSet&) = delete;
+    WoundWaitLockSet& operator=(const WoundWaitLockSet&) = delete;
+    /* call this before read/write. smaller is older. */
+    void setTxId(TxId txId) { txId_ = txId; }
+
+    /**
+     * Each call is a check point of the wounded status.
+     * If false, the transaction must abort.
+     */
+    bool lock(Mutex& mutex, Mode mode) {
+        return mode == Mode::S ? read(mutex) : write(mutex);
+    }
+    bool read(Mutex& mutex) {
+        if (status_.isWounded()) return false;
+        LockV::iterator it = find(uintptr_t(&mutex));
+        if (it != lockV_.end()) {
+            // read shared data.
+            return true;
+        }
+        lockV_.emplace_back();
+        if (!lockV_.back().lock(&mutex, Mode::S, txId_, &status_)) {
+            lockV_.pop_back();
+            return false;
+        }
+        // read shared data.
+        return true;
+    }
+    bool write(Mutex& mutex) {
+        if (status_.isWounded()) return false;
+        LockV::iterator it = find(uintptr_t(&mutex));
+        if (it != lockV_.end()) {
+            WoundWaitLock& lk = *it;
+            if (lk.mode() == Mode::S && !lk.upgrade()) return false;
+            // write shared data.
+            return true;
+        }
+        lockV_.emplace_back();
+        if (!lockV_.back().lock(&mutex, Mode::X, txId_, &status_)) {
+            lockV_.pop_back();
+            return false;
+        }
+        // write shared data.
+        return true;
+    }
+    /**
+     * Nobody wounds the transaction after all the locks are released,
+     * so the status is reset here for the next trial.
+     */
+    void clear() {
+        lockV_.clear(); // unlock.
+        index_.clear();
+        status_.reset();
+    }
+    bool empty() const {
+        return lockV_.empty() && index_.empty();
+    }
+private:
+    LockV::iterator find(uintptr_t key) {
+        const size_t threshold = 4096 / sizeof(WoundWaitLock);
+        if (lockV_.size() > threshold) {
+            for (size_t i = index_.size(); i < lockV_.size(); i++) {
+                index_[lockV_[i].getMutexId()] = i;
+            }
+            Index::iterator it = index_.find(key);
+            if (it == index_.end()) {
+                return lockV_.end();
+            } else {
+                size_t idx = it->second;
+                return lockV_.begin() + idx;
+            }
+        }
+        return std::find_if(
+            lockV_.begin(), lockV_.end(),
+            [&](const WoundWaitLock& lk) {
+                return lk.getMutexId() == key;
+            });
+    }
+};
+
+
 }} // namespace cybozu::wait_die
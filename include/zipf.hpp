@@ -0,0 +1,79 @@
+#pragma once
+/**
+ * @file
+ * @brief Zipfian distribution generator.
+ *
+ * The algorithm is from
+ * Jim Gray et al. "Quickly generating billion-record synthetic databases", SIGMOD 1994.
+ * This is the same one that YCSB's ZipfianGenerator uses.
+ */
+#include <cmath>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+
+namespace cybozu {
+namespace util {
+
+/**
+ * Random must have operator() that returns uint64_t uniform random value.
+ * Generated values are in [0, nr). Smaller value is more frequently generated.
+ */
+template <typename Random>
+class FastZipf
+{
+    Random& rand_;
+    const size_t nr_;
+    const double alpha_;
+    const double zetan_;
+    const double eta_;
+    const double threshold_;
+public:
+    /**
+     * 0 <= theta < 1.
+     * theta = 0 means uniform distribution.
+     */
+    FastZipf(Random& rand, size_t nr, double theta)
+        : FastZipf(rand, nr, theta, zeta(nr, theta)) {}
+    /**
+     * zetan must be zeta(nr, theta).
+     * Use this to share the pre-computed value among threads
+     * because zeta() takes O(nr) time.
+     */
+    FastZipf(Random& rand, size_t nr, double theta, double zetan)
+        : rand_(rand), nr_(nr), alpha_(1.0 / (1.0 - theta)), zetan_(zetan)
+        , eta_((1.0 - std::pow(2.0 / (double)nr, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan))
+        , threshold_(1.0 + std::pow(0.5, theta)) {
+        assert(0.0 <= theta && theta < 1.0);
+        assert(nr > 0);
+    }
+    size_t operator()() {
+        const double u = toUnitInterval(rand_());
+        const double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < threshold_) return std::min<size_t>(1, nr_ - 1);
+        const size_t v = nr_ * std::pow(eta_ * u - eta_ + 1.0, alpha_);
+        return std::min(v, nr_ - 1);
+    }
+    static double zeta(size_t nr, double theta) {
+        if (theta < 0.0 || theta >= 1.0) {
+            throw std::runtime_error("FastZipf: theta must be in [0, 1).");
+        }
+        double sum = 0.0;
+        for (size_t i = 1; i <= nr; i++) {
+            sum += std::pow(1.0 / (double)i, theta);
+        }
+        return sum;
+    }
+private:
+    /**
+     * [0, 1) with 53bit precision.
+     */
+    static double toUnitInterval(uint64_t v) {
+        return (v >> 11) * (1.0 / (double)(UINT64_C(1) << 53));
+    }
+};
+
+}} // namespace cybozu::util
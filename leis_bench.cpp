@@ -4,6 +4,7 @@
 #include "random.hpp"
 #include "cpuid.hpp"
 #include "measure_util.hpp"
+#include "ycsb.hpp"
 #include "leis_lock.hpp"
 
 
@@ -18,12 +19,13 @@ const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
 
 struct Shared
 {
-    std::vector<Mutex> muV;
+    cybozu::huge_page::Vector<Mutex> muV;
     size_t longTxSize;
     size_t nrOp;
     size_t nrWr;
     int shortTxMode;
     int longTxMode;
+    YcsbParam ycsbParam;
 };
 
 template <bool UseMap>
@@ -32,7 +34,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -70,6 +72,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
         }
 
         assert(llSet.empty());
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             bool abort = false;
@@ -77,7 +80,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
                 Mode mode = getMode(i);
                 Mutex& mutex = muV[rand() % muV.size()];
                 if (!llSet.lock(&mutex, mode)) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::LOCK_ORDER);
                     abort = true;
                     break;
                 }
@@ -106,6 +109,54 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     return res;
 }
 
+template <bool UseMap>
+Result ycsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+    LeisLockSet<UseMap> llSet;
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+
+        assert(llSet.empty());
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            bool abort = false;
+            for (const YcsbAccess& acc : accV) {
+                Mode mode = acc.isWrite() ? Mode::X : Mode::S;
+                Mutex& mutex = muV[acc.key];
+                if (!llSet.lock(&mutex, mode)) {
+                    res.incAbort(isLongTx, AbortReason::LOCK_ORDER);
+                    abort = true;
+                    break;
+                }
+            }
+            if (abort) {
+                llSet.recover();
+                continue;
+            }
+
+            res.incCommit(isLongTx);
+            llSet.unlock();
+            res.addRetryCount(isLongTx, retry);
+            break; // retry is not required.
+        }
+    }
+    return res;
+}
+
 void runTest()
 {
 #if 0
@@ -206,6 +257,22 @@ int main(int argc, char *argv[]) try
                 runExec(opt, shared, worker<1>);
             }
         }
+    } else if (isYcsbWorkload(opt.workload)) {
+        Shared shared;
+        shared.muV.resize(opt.getNrMu());
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            if (opt.useVector != 0) {
+                runExec(opt, shared, ycsbWorker<0>);
+            } else {
+                runExec(opt, shared, ycsbWorker<1>);
+            }
+        }
     } else {
         throw cybozu::Exception("bad workload.") << opt.workload;
     }
@@ -69,6 +69,7 @@ Result lockWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQ
         // Sort must be requried to avoid dead-lock.
         std::sort(muIdV.begin(), muIdV.end());
 
+        res.beginTx();
         for (;;) {
             assert(lockV.empty());
             const size_t sz = muIdV.size();
@@ -152,6 +153,7 @@ Result noWaitWorker(size_t idx, const bool& start, const bool& quit, bool& shoul
         // Do not sort with noWait mode.
         //std::sort(muIdV.begin(), muIdV.end());
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             assert(lockV.empty());
             bool abort = false;
@@ -178,7 +180,7 @@ Result noWaitWorker(size_t idx, const bool& start, const bool& quit, bool& shoul
 #endif
                 lockV.emplace_back();
                 if (!lockV.back().tryLock(&muV[muIdV[i]], mode)) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::LOCK_CONFLICT);
                     abort = true;
                     break;
                 }
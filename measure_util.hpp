@@ -10,10 +10,18 @@
 #include <limits>
 #include <type_traits>
 #include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include "cybozu/array.hpp"
 #include "util.hpp"
 #include "random.hpp"
 #include "cmdline_option.hpp"
 #include "thread_util.hpp"
+#include "time.hpp"
+#include "perf_counter.hpp"
+#include "epoch.hpp"
+#include "out_record.hpp"
 
 
 constexpr size_t CACHE_LINE_SIZE = 64;
@@ -176,48 +184,40 @@ public:
 };
 
 
+/**
+ * Distribution of retry counts.
+ * Small counts are recorded exactly and larger ones in power-of-two buckets,
+ * so add() is cheap enough to be called in the commit path.
+ */
 struct RetryCounts
 {
-    using Pair = std::pair<size_t, size_t>;
+    static constexpr size_t NR_EXACT = 64; // must be a power of two.
+    static constexpr size_t EXACT_BITS = 6; // log2(NR_EXACT).
+    static constexpr size_t NR_BUCKETS = NR_EXACT + 64 - EXACT_BITS;
 
-    std::unordered_map<size_t, size_t> retryCounts;
+    size_t counts[NR_BUCKETS];
+    size_t maxRetry;
 
+    RetryCounts() : counts(), maxRetry(0) {}
     void add(size_t nrRetry, size_t nr = 1) {
-        std::unordered_map<size_t, size_t>::iterator it = retryCounts.find(nrRetry);
-        if (it == retryCounts.end()) {
-            retryCounts.emplace(nrRetry, nr);
-        } else {
-            it->second += nr;
-        }
+        counts[getIdx(nrRetry)] += nr;
+        if (nrRetry > maxRetry) maxRetry = nrRetry;
     }
     void merge(const RetryCounts& rhs) {
-        for (const Pair& p : rhs.retryCounts) {
-            add(p.first, p.second);
+        for (size_t i = 0; i < NR_BUCKETS; i++) {
+            counts[i] += rhs.counts[i];
         }
+        maxRetry = std::max(maxRetry, rhs.maxRetry);
     }
     friend std::ostream& out(std::ostream& os, const RetryCounts& rc, bool verbose) {
-        std::vector<Pair> v;
-        v.reserve(rc.retryCounts.size());
-        for (const Pair& p : rc.retryCounts) {
-            v.push_back(p);
-        }
-        std::sort(v.begin(), v.end());
-
-#if 0
         if (verbose) {
-            for (const Pair& p : v) {
-                os << cybozu::util::formatString("%5zu %zu\n", p.first, p.second);
+            for (size_t i = 0; i < NR_BUCKETS; i++) {
+                if (rc.counts[i] == 0) continue;
+                os << cybozu::util::formatString("%11s %zu\n", rangeStr(i).c_str(), rc.counts[i]);
             }
         } else {
-            if (!v.empty()) {
-                os << cybozu::util::formatString("max_retry %zu", v.back().first);
-            } else {
-                os << "max_retry 0";
-            }
+            os << cybozu::util::formatString("max_retry %zu", rc.maxRetry);
         }
-#else
-        unused(verbose);
-#endif
         return os;
     }
     friend std::ostream& operator<<(std::ostream& os, const RetryCounts& rc) {
@@ -228,38 +228,266 @@ struct RetryCounts
         out(ss, *this, verbose);
         return ss.str();
     }
+    /**
+     * Distribution in one token like "0=100,1=10,64-127=1".
+     * "-" means empty.
+     */
+    std::string distStr() const {
+        std::string s;
+        for (size_t i = 0; i < NR_BUCKETS; i++) {
+            if (counts[i] == 0) continue;
+            if (!s.empty()) s += ',';
+            s += cybozu::util::formatString("%s=%zu", rangeStr(i).c_str(), counts[i]);
+        }
+        return s.empty() ? "-" : s;
+    }
+    /**
+     * Put non-empty buckets like {"0":100,"64-127":1}.
+     */
+    void putTo(OutRecord& rec) const {
+        for (size_t i = 0; i < NR_BUCKETS; i++) {
+            if (counts[i] == 0) continue;
+            rec.addNumber(rangeStr(i), counts[i]);
+        }
+    }
+private:
+    static size_t getIdx(size_t nrRetry) {
+        if (nrRetry < NR_EXACT) return nrRetry;
+        const size_t msb = 63 - __builtin_clzll(nrRetry);
+        return NR_EXACT + msb - EXACT_BITS;
+    }
+    static std::string rangeStr(size_t idx) {
+        if (idx < NR_EXACT) return cybozu::util::formatString("%zu", idx);
+        const size_t msb = idx - NR_EXACT + EXACT_BITS;
+        const size_t min = size_t(1) << msb;
+        return cybozu::util::formatString("%zu-%zu", min, min + (min - 1));
+    }
+};
+
+
+/**
+ * Why a transaction is aborted.
+ */
+enum class AbortReason : uint8_t
+{
+    VALIDATION = 0, // read set validation failed.
+    LOCK_CONFLICT, // lock conflicted and the protocol does not wait (no-wait).
+    DIE, // younger transaction conflicted with an older one (wait-die).
+    UPGRADE, // failed to upgrade a shared lock.
+    LOCK_ORDER, // lock order was violated and locks were recovered (leis).
+    INTERCEPTED, // lock was intercepted by a prior transaction (trlock).
+    DEADLOCK, // chosen as the victim of a deadlock (dl-detect).
+    WOUNDED, // wounded by an older transaction (wound-wait).
+    MAX,
+};
+
+constexpr size_t NR_ABORT_REASONS = size_t(AbortReason::MAX);
+
+inline const char* abortReasonStr(AbortReason reason)
+{
+    static const char *const tbl[] = {
+        "validation", "lock-conflict", "die", "upgrade", "lock-order", "intercepted", "deadlock", "wounded",
+    };
+    static_assert(sizeof(tbl) / sizeof(tbl[0]) == NR_ABORT_REASONS, "abortReasonStr: bad table size.");
+    assert(reason < AbortReason::MAX);
+    return tbl[size_t(reason)];
+}
+
+
+/**
+ * Log-bucketed histogram like HdrHistogram.
+ * Values are grouped by the most significant bit and
+ * each group is divided into 16 sub-buckets, so the relative error is up to 1/16.
+ */
+struct LatencyHistogram
+{
+    static constexpr size_t SUB_BITS = 4;
+    static constexpr size_t NR_SUB = size_t(1) << SUB_BITS;
+    static constexpr size_t NR_BUCKETS = (64 - SUB_BITS + 1) * NR_SUB;
+
+    uint64_t count[NR_BUCKETS];
+    uint64_t total;
+
+    LatencyHistogram() : count(), total(0) {}
+    void add(uint64_t v) {
+        count[getIdx(v)]++;
+        total++;
+    }
+    void merge(const LatencyHistogram& rhs) {
+        for (size_t i = 0; i < NR_BUCKETS; i++) {
+            count[i] += rhs.count[i];
+        }
+        total += rhs.total;
+    }
+    /**
+     * 0 < ratio <= 1.
+     * Returns the highest value of the bucket that contains the percentile.
+     */
+    uint64_t getPercentile(double ratio) const {
+        if (total == 0) return 0;
+        uint64_t target = std::max<uint64_t>(1, uint64_t(ratio * total + 0.5));
+        target = std::min(target, total);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < NR_BUCKETS; i++) {
+            sum += count[i];
+            if (sum >= target) return getMax(i);
+        }
+        return getMax(NR_BUCKETS - 1);
+    }
+    /**
+     * Put non-empty buckets as {"the highest value in microseconds":count,...}.
+     */
+    void putTo(OutRecord& rec, double ticksPerUs) const {
+        for (size_t i = 0; i < NR_BUCKETS; i++) {
+            if (count[i] == 0) continue;
+            rec.addNumber(cybozu::util::formatString("%.3f", getMax(i) / ticksPerUs), size_t(count[i]));
+        }
+    }
+private:
+    static size_t getIdx(uint64_t v) {
+        if (v < NR_SUB) return v;
+        const size_t msb = 63 - __builtin_clzll(v);
+        const size_t shift = msb - SUB_BITS;
+        return (shift + 1) * NR_SUB + ((v >> shift) - NR_SUB);
+    }
+    static uint64_t getMax(size_t idx) {
+        if (idx < NR_SUB) return idx;
+        const size_t shift = idx / NR_SUB - 1;
+        const uint64_t min = (NR_SUB + idx % NR_SUB) << shift;
+        return min + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+
+/**
+ * Counters of each worker that the main thread can read during execution.
+ * Each slot occupies its own cache line.
+ */
+class ResultSlots
+{
+    static constexpr size_t STRIDE = CACHE_LINE_SIZE / sizeof(size_t);
+    cybozu::AlignedArray<size_t, CACHE_LINE_SIZE, true> buf_;
+public:
+    static constexpr size_t NR_VALUES = 6;
+    static_assert(NR_VALUES <= STRIDE, "ResultSlots: a slot must fit a cache line.");
+
+    explicit ResultSlots(size_t nrTh) : buf_(nrTh * STRIDE) {}
+    size_t *get(size_t idx) { return &buf_[idx * STRIDE]; }
+    size_t load(size_t idx, size_t i) const {
+        return __atomic_load_n(&buf_[idx * STRIDE + i], __ATOMIC_RELAXED);
+    }
 };
 
 
+/**
+ * The slot of the current thread. nullptr means no slot.
+ * runExec() sets it in each worker thread.
+ */
+inline size_t*& resultSlotOfThisThread()
+{
+    static thread_local size_t *slot = nullptr;
+    return slot;
+}
+
+
+/**
+ * The measurement epoch of the current thread. nullptr means no epoch.
+ * runExec() increments it at the end of warm-up
+ * and Result discards what it counted in the previous epoch.
+ */
+inline const size_t*& resultEpochOfThisThread()
+{
+    static thread_local const size_t *epoch = nullptr;
+    return epoch;
+}
+
+
+/**
+ * The epoch manager of the current run. nullptr means no run.
+ * runExec() sets it in each worker thread.
+ * Objects given to retire() must be alive until runExec() returns.
+ */
+inline cybozu::epoch::EpochManager*& epochManagerOfThisThread()
+{
+    static thread_local cybozu::epoch::EpochManager *ebr = nullptr;
+    return ebr;
+}
+
+
 struct Result
 {
     RetryCounts rcS;
     RetryCounts rcL;
     size_t value[6];
-    Result() : rcS(), rcL(), value() {}
+    size_t *slot; // value[] is published here if not null.
+    LatencyHistogram latS; // in TSC ticks.
+    LatencyHistogram latL;
+    uint64_t txBeginTsc; // 0 means not measured.
+    size_t abortReasonS[NR_ABORT_REASONS]; // including intercepted.
+    size_t abortReasonL[NR_ABORT_REASONS];
+    const size_t *epochP; // shared epoch if not null.
+    size_t epoch; // epoch of the counted values.
+    Result()
+        : rcS(), rcL(), value(), slot(resultSlotOfThisThread())
+        , latS(), latL(), txBeginTsc(0), abortReasonS(), abortReasonL()
+        , epochP(resultEpochOfThisThread()), epoch(epochP ? loadEpoch() : 0) {}
     void operator+=(const Result& rhs) {
         rcS.merge(rhs.rcS);
         rcL.merge(rhs.rcL);
+        latS.merge(rhs.latS);
+        latL.merge(rhs.latL);
+        for (size_t i = 0; i < NR_ABORT_REASONS; i++) {
+            abortReasonS[i] += rhs.abortReasonS[i];
+            abortReasonL[i] += rhs.abortReasonL[i];
+        }
         for (size_t i = 0; i < 6; i++) {
             value[i] += rhs.value[i];
         }
     }
     size_t nrCommit() const { return value[0] + value[1]; }
-    void incCommit(bool isLongTx) { value[isLongTx ? 1 : 0]++; }
-    void addCommit(bool isLongTx, size_t v) { value[isLongTx ? 1 : 0] += v; }
-    void incAbort(bool isLongTx) { value[isLongTx ? 3 : 2]++; }
-    void incIntercepted(bool isLongTx) { value[isLongTx ? 5 : 4]++; }
+    /**
+     * Call this before the first trial of a transaction.
+     * The latency from here to incCommit() will be recorded.
+     */
+    void beginTx() { txBeginTsc = cybozu::time::rdtsc(); }
+    void incCommit(bool isLongTx) {
+        addValue(isLongTx ? 1 : 0, 1);
+        if (txBeginTsc != 0) {
+            (isLongTx ? latL : latS).add(cybozu::time::rdtsc() - txBeginTsc);
+            txBeginTsc = 0;
+        }
+    }
+    void addCommit(bool isLongTx, size_t v) { addValue(isLongTx ? 1 : 0, v); }
+    void incAbort(bool isLongTx, AbortReason reason) {
+        addValue(isLongTx ? 3 : 2, 1);
+        (isLongTx ? abortReasonL : abortReasonS)[size_t(reason)]++;
+    }
+    void incIntercepted(bool isLongTx, AbortReason reason = AbortReason::INTERCEPTED) {
+        addValue(isLongTx ? 5 : 4, 1);
+        (isLongTx ? abortReasonL : abortReasonS)[size_t(reason)]++;
+    }
+    /**
+     * Discard the values counted in the previous epoch.
+     * Counting calls this, and runExec() calls it for workers that have not counted since then.
+     */
+    void discardIfStale() {
+        if (epochP && loadEpoch() != epoch) {
+            rcS = RetryCounts();
+            rcL = RetryCounts();
+            latS = LatencyHistogram();
+            latL = LatencyHistogram();
+            std::fill(std::begin(value), std::end(value), 0);
+            std::fill(std::begin(abortReasonS), std::end(abortReasonS), 0);
+            std::fill(std::begin(abortReasonL), std::end(abortReasonL), 0);
+            epoch = loadEpoch();
+        }
+    }
     void addRetryCount(bool isLongTx, size_t nrRetry) {
-#if 0
         if (isLongTx) {
             rcL.add(nrRetry);
         } else {
             rcS.add(nrRetry);
         }
-#else
-        unused(isLongTx);
-        unused(nrRetry);
-#endif
     }
 
     friend std::ostream& operator<<(std::ostream& os, const Result& res) {
@@ -282,6 +510,22 @@ struct Result
             , res.value[0], res.value[1]
             , res.value[2], res.value[3]
             , res.value[4], res.value[5]);
+        // latencies in microseconds.
+        const double ticksPerUs = cybozu::time::tscTicksPerNs() * 1000;
+        os << cybozu::util::formatString(
+            " p50S_us:%.3f p99S_us:%.3f p999S_us:%.3f p50L_us:%.3f p99L_us:%.3f p999L_us:%.3f"
+            , res.latS.getPercentile(0.5) / ticksPerUs
+            , res.latS.getPercentile(0.99) / ticksPerUs
+            , res.latS.getPercentile(0.999) / ticksPerUs
+            , res.latL.getPercentile(0.5) / ticksPerUs
+            , res.latL.getPercentile(0.99) / ticksPerUs
+            , res.latL.getPercentile(0.999) / ticksPerUs);
+        os << cybozu::util::formatString(
+            " maxRetryS:%zu maxRetryL:%zu retryS:%s retryL:%s"
+            , res.rcS.maxRetry, res.rcL.maxRetry
+            , res.rcS.distStr().c_str(), res.rcL.distStr().c_str());
+        os << " abortReasonS:" << abortReasonDistStr(res.abortReasonS)
+           << " abortReasonL:" << abortReasonDistStr(res.abortReasonL);
         if (verbose) {
             // not yet implemented.
         }
@@ -293,6 +537,161 @@ struct Result
         ss << *this;
         return ss.str();
     }
+    /**
+     * Put the same values as operator<<().
+     * withHistogram: put latency histograms also.
+     */
+    void putTo(OutRecord& rec, bool withHistogram) const {
+        static const char *const name[] = {
+            "commitS", "commitL", "abortS", "abortL", "interceptedS", "interceptedL",
+        };
+        for (size_t i = 0; i < 6; i++) {
+            rec.addNumber(name[i], value[i]);
+        }
+        const double ticksPerUs = cybozu::time::tscTicksPerNs() * 1000;
+        for (const bool isLongTx : {false, true}) {
+            const char c = isLongTx ? 'L' : 'S';
+            const LatencyHistogram& lat = isLongTx ? latL : latS;
+            const RetryCounts& rc = isLongTx ? rcL : rcS;
+            const size_t *reasons = isLongTx ? abortReasonL : abortReasonS;
+            rec.addNumber(cybozu::util::formatString("p50%c_us", c), lat.getPercentile(0.5) / ticksPerUs);
+            rec.addNumber(cybozu::util::formatString("p99%c_us", c), lat.getPercentile(0.99) / ticksPerUs);
+            rec.addNumber(cybozu::util::formatString("p999%c_us", c), lat.getPercentile(0.999) / ticksPerUs);
+            rec.addNumber(cybozu::util::formatString("maxRetry%c", c), rc.maxRetry);
+            rc.putTo(rec.addObject(cybozu::util::formatString("retry%c", c), true));
+            OutRecord& ar = rec.addObject(cybozu::util::formatString("abortReason%c", c), true);
+            for (size_t i = 0; i < NR_ABORT_REASONS; i++) {
+                ar.addNumber(abortReasonStr(AbortReason(i)), reasons[i]);
+            }
+            if (withHistogram) {
+                lat.putTo(rec.addObject(cybozu::util::formatString("latency%c_us", c), true), ticksPerUs);
+            }
+        }
+    }
+private:
+    /**
+     * Like "validation=10,upgrade=2". "-" means no abort.
+     */
+    static std::string abortReasonDistStr(const size_t (&reasons)[NR_ABORT_REASONS]) {
+        std::string s;
+        for (size_t i = 0; i < NR_ABORT_REASONS; i++) {
+            if (reasons[i] == 0) continue;
+            if (!s.empty()) s += ',';
+            s += cybozu::util::formatString("%s=%zu", abortReasonStr(AbortReason(i)), reasons[i]);
+        }
+        return s.empty() ? "-" : s;
+    }
+    size_t loadEpoch() const {
+        return __atomic_load_n(epochP, __ATOMIC_RELAXED);
+    }
+    /**
+     * Values counted in the previous epoch are discarded.
+     * The slot keeps counting across epochs.
+     */
+    void addValue(size_t i, size_t v) {
+        discardIfStale();
+        value[i] += v;
+        if (slot) __atomic_store_n(&slot[i], slot[i] + v, __ATOMIC_RELAXED);
+    }
+};
+
+
+/**
+ * Like " cyclesPerCommit:1234.5 instructionsPerCommit:...".
+ * "-" means the event was not counted.
+ */
+inline std::string perfCountsStr(const cybozu::perf::Counts& counts, size_t nrCommit, bool useRaw)
+{
+    using cybozu::perf::Event;
+    std::string s;
+    for (size_t i = 0; i < cybozu::perf::NR_EVENTS; i++) {
+        const Event ev = Event(i);
+        if (ev == Event::RAW && !useRaw) continue;
+        s += cybozu::util::formatString(" %sPerCommit:", cybozu::perf::eventStr(ev));
+        if (counts.isValid(ev) && nrCommit != 0) {
+            s += cybozu::util::formatString("%.1f", counts.get(ev) / (double)nrCommit);
+        } else {
+            s += "-";
+        }
+    }
+    return s;
+}
+
+
+/**
+ * Like " ebrRetired:100 ebrReclaimed:90 ...".
+ * limboBytes is what remained at the end of the run.
+ */
+inline std::string epochStatStr(const cybozu::epoch::Stat& st)
+{
+    const double ticksPerUs = cybozu::time::tscTicksPerNs() * 1000;
+    return cybozu::util::formatString(
+        " ebrRetired:%zu ebrReclaimed:%zu ebrLimboBytes:%zu ebrPeakLimboBytes:%zu"
+        " ebrLagAvg_us:%.3f ebrLagMax_us:%.3f"
+        , st.nrRetired, st.nrReclaimed, st.limboBytes, st.peakLimboBytes
+        , st.nrReclaimed == 0 ? 0 : st.sumLagTsc / ticksPerUs / st.nrReclaimed
+        , st.maxLagTsc / ticksPerUs);
+}
+
+
+/**
+ * Put throughput and aborts of each interval.
+ */
+class Timeline
+{
+    const ResultSlots& slots_;
+    const size_t nrTh_;
+    size_t idx_;
+    double prevSec_;
+    size_t prev_[ResultSlots::NR_VALUES];
+    OutRecord *rec_; // an array to add intervals. nullptr means printing them.
+public:
+    /**
+     * Values counted before this are not put.
+     */
+    Timeline(const ResultSlots& slots, size_t nrTh, OutRecord *rec = nullptr)
+        : slots_(slots), nrTh_(nrTh), idx_(0), prevSec_(0), prev_(), rec_(rec) {
+        loadAll(prev_);
+    }
+    void put(double elapsedSec) {
+        size_t cur[ResultSlots::NR_VALUES];
+        loadAll(cur);
+        size_t d[ResultSlots::NR_VALUES];
+        for (size_t j = 0; j < ResultSlots::NR_VALUES; j++) {
+            d[j] = cur[j] - prev_[j];
+            prev_[j] = cur[j];
+        }
+        const double sec = elapsedSec - prevSec_;
+        prevSec_ = elapsedSec;
+        if (rec_) {
+            OutRecord& r = rec_->addObject("");
+            r.addNumber("elapsed", elapsedSec);
+            r.addNumber("tps", (d[0] + d[1]) / sec);
+            static const char *const name[] = {
+                "commitS", "commitL", "abortS", "abortL", "interceptedS", "interceptedL",
+            };
+            for (size_t j = 0; j < ResultSlots::NR_VALUES; j++) {
+                r.addNumber(name[j], d[j]);
+            }
+            idx_++;
+            return;
+        }
+        ::printf("timeline:%zu elapsed:%.03f tps:%.03f "
+                 "commitS:%zu commitL:%zu abortS:%zu abortL:%zu interceptedS:%zu interceptedL:%zu\n"
+                 , idx_, elapsedSec, (d[0] + d[1]) / sec
+                 , d[0], d[1], d[2], d[3], d[4], d[5]);
+        ::fflush(::stdout);
+        idx_++;
+    }
+private:
+    void loadAll(size_t (&cur)[ResultSlots::NR_VALUES]) const {
+        std::fill(std::begin(cur), std::end(cur), 0);
+        for (size_t i = 0; i < nrTh_; i++) {
+            for (size_t j = 0; j < ResultSlots::NR_VALUES; j++) {
+                cur[j] += slots_.load(i, j);
+            }
+        }
+    }
 };
 
 
@@ -306,36 +705,120 @@ void runExec(const CmdLineOption& opt, SharedData& shared, Worker&& worker)
     bool shouldQuit = false;
     cybozu::thread::ThreadRunnerSet thS;
     std::vector<Result> resV(nrTh);
+    ResultSlots slots(nrTh);
+    std::vector<cybozu::perf::CounterGroup> perfV(opt.usePerf ? nrTh : 0);
+    std::atomic<size_t> nrPerfReady(0);
+    cybozu::epoch::EpochManager ebr(nrTh);
+    size_t epoch = 0;
+    cybozu::time::tscTicksPerNs(); // calibrate before running.
     for (size_t i = 0; i < nrTh; i++) {
         thS.add([&,i]() {
+                if (opt.usePerf) {
+                    // Counters follow the thread wherever it runs.
+                    perfV[i].open(opt.perfRaw);
+                    nrPerfReady++;
+                }
+                resultSlotOfThisThread() = slots.get(i);
+                resultEpochOfThisThread() = &epoch;
+                epochManagerOfThisThread() = &ebr;
                 resV[i] = worker(i, start, quit, shouldQuit, shared);
+                resultSlotOfThisThread() = nullptr;
+                resultEpochOfThisThread() = nullptr;
+                epochManagerOfThisThread() = nullptr;
             });
     }
     thS.start();
+    if (opt.usePerf) {
+        while (nrPerfReady.load() < nrTh) std::this_thread::yield();
+        for (cybozu::perf::CounterGroup& pc : perfV) pc.enable();
+    }
     start = true;
+    using Clock = std::chrono::steady_clock;
+    if (opt.warmupSec != 0) {
+        const Clock::time_point end = Clock::now() + std::chrono::seconds(opt.warmupSec);
+        // Check shouldQuit every second.
+        while (!shouldQuit && Clock::now() < end) {
+            std::this_thread::sleep_until(std::min(end, Clock::now() + std::chrono::seconds(1)));
+        }
+        // Counts of warm-up will be discarded by each worker.
+        __atomic_store_n(&epoch, 1, __ATOMIC_RELAXED);
+        for (cybozu::perf::CounterGroup& pc : perfV) pc.reset();
+    }
+    const Clock::time_point begin = Clock::now();
+    const size_t runMs = opt.runSec * 1000;
+    const size_t stepMs = opt.intervalMs != 0 ? opt.intervalMs : 1000;
+    const bool isText = opt.outFormat == "text";
+    OutRecord timelineRec("", OutRecord::Type::ARRAY, true);
+    Timeline timeline(slots, nrTh, isText ? nullptr : &timelineRec);
+    size_t ms = 0;
     size_t sec = 0;
-    for (size_t i = 0; i < opt.runSec; i++) {
-        if (opt.verbose) {
-            ::printf("%zu\n", i);
+    while (ms < runMs) {
+        if (opt.verbose && isText && ms >= sec * 1000) {
+            ::printf("%zu\n", sec);
+            sec++;
+        }
+        ms = std::min(ms + stepMs, runMs);
+        std::this_thread::sleep_until(begin + std::chrono::milliseconds(ms));
+        if (opt.intervalMs != 0) {
+            timeline.put(std::chrono::duration<double>(Clock::now() - begin).count());
         }
-        sleepMs(1000);
-        sec++;
         if (shouldQuit) break;
     }
+    for (cybozu::perf::CounterGroup& pc : perfV) pc.disable();
     quit = true;
+    // shouldQuit may stop running early.
+    const double elapsedSec = std::chrono::duration<double>(Clock::now() - begin).count();
     thS.join();
+    // Statistics of the run before the rest is reclaimed.
+    const cybozu::epoch::Stat ebrStat = ebr.stat();
+    ebr.reclaimAll();
+    const std::string ebrStr = ebrStat.nrRetired == 0 ? "" : epochStatStr(ebrStat);
     Result res;
     for (size_t i = 0; i < nrTh; i++) {
-        if (opt.verbose) {
+        resV[i].discardIfStale(); // a worker may have counted nothing after warm-up.
+        if (opt.verbose && isText) {
             ::printf("worker %zu  %s\n", i, resV[i].str().c_str());
         }
         res += resV[i];
     }
-    ::printf("%s tps:%.03f %s\n"
-             , opt.str().c_str()
-             , res.nrCommit() / (double)opt.runSec
-             , res.str().c_str());
-    ::fflush(::stdout);
+    std::string perfStr;
+    if (opt.usePerf) {
+        cybozu::perf::Counts counts;
+        for (const cybozu::perf::CounterGroup& pc : perfV) {
+            counts += pc.read();
+        }
+        if (!perfV[0].isAvailable()) {
+            ::fprintf(::stderr, "perf counters are not available: %s\n", ::strerror(perfV[0].error()));
+        }
+        perfStr = perfCountsStr(counts, res.nrCommit(), opt.perfRaw != 0);
+    }
+    if (isText) {
+        ::printf("%s elapsed:%.03f tps:%.03f %s%s%s\n"
+                 , opt.str().c_str(), elapsedSec
+                 , res.nrCommit() / elapsedSec
+                 , res.str().c_str(), ebrStr.c_str(), perfStr.c_str());
+        ::fflush(::stdout);
+        return;
+    }
+    OutRecord rec;
+    rec.addObject("options").addKeyValueTokens(opt.str());
+    rec.addNumber("elapsed", elapsedSec);
+    rec.addNumber("tps", res.nrCommit() / elapsedSec);
+    res.putTo(rec.addObject("result"), true);
+    OutRecord& thV = rec.addArray("threads");
+    for (size_t i = 0; i < nrTh; i++) {
+        resV[i].putTo(thV.addObject(""), false);
+    }
+    if (!ebrStr.empty()) {
+        rec.addObject("ebr").addKeyValueTokens(ebrStr);
+    }
+    if (opt.usePerf) {
+        rec.addObject("perf").addKeyValueTokens(perfStr);
+    }
+    if (opt.intervalMs != 0) {
+        rec.addRecord("timeline", timelineRec);
+    }
+    rec.put(opt.outFormat);
 }
 
 enum TxMode
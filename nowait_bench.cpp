@@ -3,6 +3,7 @@
 #include <immintrin.h>
 #include <unistd.h>
 #include "cpuid.hpp"
+#include "ycsb.hpp"
 #include "measure_util.hpp"
 #include "lock.hpp"
 
@@ -16,12 +17,13 @@ const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
 
 struct Shared
 {
-    std::vector<Mutex> muV;
+    cybozu::huge_page::Vector<Mutex> muV;
     size_t longTxSize;
     size_t nrOp;
     size_t nrWr;
     int shortTxMode;
     int longTxMode;
+    YcsbParam ycsbParam;
 };
 
 Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
@@ -29,7 +31,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -83,6 +85,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
         // Do not sort with noWait mode.
         //std::sort(muIdV.begin(), muIdV.end());
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(lockV.empty());
@@ -93,7 +96,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
                 Mode mode = getMode(i);
                 lockV.emplace_back();
                 if (!lockV.back().tryLock(&muV[muIdV[i]], mode)) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::LOCK_CONFLICT);
                     abort = true;
                     break;
                 }
@@ -127,7 +130,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -164,6 +167,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             fillModeVec(isWriteV, rand, nrWr, tmpV2);
         }
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(lockV.empty());
@@ -177,7 +181,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
                 }
             }
             if (abort) {
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, lockSet.isUpgradeFailed() ? AbortReason::UPGRADE : AbortReason::LOCK_CONFLICT);
                 lockSet.clear();
                 continue;
             }
@@ -192,6 +196,53 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
 }
 
 
+Result ycsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+    cybozu::lock::NoWaitLockSet lockSet;
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            assert(lockSet.empty());
+            bool abort = false;
+            for (const YcsbAccess& acc : accV) {
+                Mode mode = acc.isWrite() ? Mode::X : Mode::S;
+                Mutex& mutex = muV[acc.key];
+                if (!lockSet.lock(mutex, mode)) {
+                    abort = true;
+                    break;
+                }
+            }
+            if (abort) {
+                res.incAbort(isLongTx, lockSet.isUpgradeFailed() ? AbortReason::UPGRADE : AbortReason::LOCK_CONFLICT);
+                lockSet.clear();
+                continue;
+            }
+
+            res.incCommit(isLongTx);
+            lockSet.clear();
+            res.addRetryCount(isLongTx, retry);
+            break; // retry is not required.
+        }
+    }
+    return res;
+}
+
 void runTest()
 {
 #if 0
@@ -291,6 +342,18 @@ int main(int argc, char *argv[]) try
         for (size_t i = 0; i < opt.nrLoop; i++) {
             runExec(opt, shared, worker2);
         }
+    } else if (isYcsbWorkload(opt.workload)) {
+        Shared shared;
+        shared.muV.resize(opt.getNrMu());
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, ycsbWorker);
+        }
     } else {
         throw cybozu::Exception("bad workload.") << opt.workload;
     }
@@ -1,12 +1,20 @@
 #include <ctime>
 #include <vector>
 #include <chrono>
+#include <utility>
+#include <memory>
+#include <unordered_map>
 #include <unistd.h>
 #include "occ.hpp"
 #include "thread_util.hpp"
 #include "random.hpp"
 #include "measure_util.hpp"
 #include "cpuid.hpp"
+#include "ycsb.hpp"
+#include "tpcc.hpp"
+#include "record_store.hpp"
+#include "btree.hpp"
+#include "mvcc.hpp"
 
 
 using Mutex = cybozu::occ::OccLock::Mutex;
@@ -16,12 +24,35 @@ const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
 
 struct Shared
 {
-    std::vector<Mutex> muV;
+    cybozu::huge_page::Vector<Mutex> muV;
     size_t longTxSize;
     size_t nrOp;
     size_t nrWr;
     int shortTxMode;
     int longTxMode;
+    YcsbParam ycsbParam;
+    TpccTables<Mutex> tpcc;
+
+    // For custom workload.
+    bool useMvcc;
+    cybozu::mvcc::VersionStore versionS; // record values if useMvcc.
+
+    /*
+     * For insert workload.
+     * Worker idx owns keys j * nrTh + idx for j in its window [lo, hi).
+     * It inserts keys at hi and deletes keys at lo.
+     */
+    struct alignas(64) KeyWindow
+    {
+        uint64_t lo;
+        uint64_t hi;
+    };
+    std::vector<KeyWindow> windowV;
+    cybozu::index::BTree index; // key to slot of muV.
+    cybozu::huge_page::Vector<uint64_t> keyV; // key of each slot.
+    SlotPool slotPool;
+    std::vector<std::unique_ptr<LocalSlotAllocator> > slotAllocV; // for each worker.
+    size_t insPct;
 };
 
 
@@ -33,7 +64,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -47,6 +78,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     std::vector<Mutex*> writeSet;
     std::vector<cybozu::occ::OccReader> readSet;
     std::vector<cybozu::occ::OccLock> lockV;
+    cybozu::occ::TidGenerator tidGen;
 
     std::vector<size_t> tmpV; // for fillMuIdVecArray.
 
@@ -91,6 +123,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
             }
         }
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             // Try to run transaction.
@@ -129,6 +162,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
                 lockV.emplace_back(mutex);
             }
             __atomic_thread_fence(__ATOMIC_ACQ_REL);
+            const uint32_t epoch = cybozu::occ::globalEpoch().load();
             for (cybozu::occ::OccReader& r : readSet) {
                 const Mutex *p = reinterpret_cast<Mutex*>(r.getMutexId());
                 const bool ret =
@@ -143,13 +177,16 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
                 lockV.clear();
                 writeSet.clear();
                 readSet.clear();
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
                 continue;
             }
             // We can commit.
+            for (const cybozu::occ::OccReader& r : readSet) tidGen.observe(r.getTid());
+            for (const cybozu::occ::OccLock& lk : lockV) tidGen.observe(lk.getTid());
+            const uint64_t tid = tidGen.generate(epoch);
             for (cybozu::occ::OccLock& lk : lockV) {
                 // should write resource here.
-                lk.update();
+                lk.update(tid);
                 lk.writeFence();
                 lk.unlock();
             }
@@ -165,12 +202,23 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
 }
 
 
+struct MvccWrite
+{
+    size_t slot;
+    uint64_t value;
+};
+
+
+/**
+ * If shared.useMvcc, records have values in the version store.
+ * Read-only long transactions read a snapshot then, so they never abort.
+ */
 Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
 {
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -193,6 +241,15 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
 
     const bool isLongTx = longTxSize != 0 && idx == 0; // starvation setting.
     const size_t realNrOp = isLongTx ? longTxSize : nrOp;
+
+    const bool useMvcc = shared.useMvcc;
+    const bool isSnapshotTx = useMvcc && isLongTx && longTxMode == USE_READONLY_TX;
+    cybozu::mvcc::VersionStore& versionS = shared.versionS;
+    cybozu::epoch::EpochManager& ebr = *epochManagerOfThisThread();
+    std::vector<MvccWrite> mvccWriteV;
+    const size_t gcInterval = 64; // commits to update gcTs.
+    uint64_t gcTs = 0;
+    size_t nrCommit = 0;
     if (!isLongTx && shortTxMode == USE_MIX_TX) {
         isWriteV.resize(nrOp);
     }
@@ -207,17 +264,108 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             fillModeVec(isWriteV, rand, nrWr, tmpV2);
         }
 
+        res.beginTx();
+        if (useMvcc) ebr.enter(idx);
+        if (isSnapshotTx) {
+            const uint64_t ts = versionS.beginSnapshot(idx);
+            uint64_t sum = 0;
+            for (size_t i = 0; i < realNrOp; i++) {
+                const size_t slot = rand() % muV.size();
+                cybozu::occ::OccReader r;
+                r.prepare(&muV[slot]); // wait for the updater to install its version.
+                r.readFence();
+                sum += versionS.find(slot, ts).value;
+            }
+            unused(sum);
+            versionS.endSnapshot(idx);
+            ebr.leave(idx);
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, 0);
+            continue;
+        }
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             // Try to run transaction.
             assert(lockSet.empty());
+            assert(mvccWriteV.empty());
 
             for (size_t i = 0; i < realNrOp; i++) {
                 const bool isWrite = bool(getMode(i));
-                Mutex& mutex = muV[rand() % muV.size()];
-                lockSet.read(mutex);
+                const size_t slot = rand() % muV.size();
+                Mutex& mutex = muV[slot];
+                uint64_t value = 0;
+                lockSet.read(mutex, [&]() { if (useMvcc) value = versionS.newest(slot).value; });
                 if (isWrite) {
                     lockSet.write(mutex);
+                    if (useMvcc) mvccWriteV.push_back(MvccWrite{slot, value + 1});
+                }
+            }
+
+            // commit phase.
+            lockSet.lock();
+            const uint64_t ts = useMvcc ? versionS.commitTs() : 0;
+            if (!lockSet.verify()) {
+                lockSet.clear();
+                mvccWriteV.clear();
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                continue;
+            }
+            if (useMvcc) {
+                if (nrCommit++ % gcInterval == 0) gcTs = versionS.gcTs();
+                // The first write of each record has the value read.
+                std::stable_sort(mvccWriteV.begin(), mvccWriteV.end(),
+                                 [](const MvccWrite& a, const MvccWrite& b) { return a.slot < b.slot; });
+                mvccWriteV.erase(std::unique(mvccWriteV.begin(), mvccWriteV.end(),
+                                             [](const MvccWrite& a, const MvccWrite& b) { return a.slot == b.slot; }),
+                                 mvccWriteV.end());
+                for (const MvccWrite& w : mvccWriteV) {
+                    versionS.install(w.slot, ts, w.value, gcTs, ebr, idx);
+                }
+                mvccWriteV.clear();
+            }
+            lockSet.updateAndUnlock();
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+        if (useMvcc) ebr.leave(idx);
+    }
+    return res;
+}
+
+Result ycsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+
+    cybozu::occ::LockSet lockSet;
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            // Try to run transaction.
+            assert(lockSet.empty());
+
+            for (const YcsbAccess& acc : accV) {
+                Mutex& mutex = muV[acc.key];
+                if (acc.isRead()) {
+                    lockSet.read(mutex);
+                }
+                if (acc.isWrite()) {
+                    lockSet.write(mutex);
                 }
             }
 
@@ -225,7 +373,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             lockSet.lock();
             if (!lockSet.verify()) {
                 lockSet.clear();
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
                 continue;
             }
             lockSet.updateAndUnlock();
@@ -237,6 +385,317 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
     return res;
 }
 
+
+/**
+ * Access to TPC-C records with silo-occ.
+ * Writes are buffered and installed in the commit phase.
+ * Records read or written are cached per mutex
+ * because lockSet_.read() does not call readFunc for the records in the read set.
+ */
+class OccTpccTx
+{
+    cybozu::occ::LockSet& lockSet_;
+    TpccWriteBuffer& writeBuf_;
+    std::vector<char> localBuf_;
+    std::unordered_map<uintptr_t, size_t> localM_; // key: mutex addr, value: offset in localBuf_.
+public:
+    OccTpccTx(cybozu::occ::LockSet& lockSet, TpccWriteBuffer& writeBuf)
+        : lockSet_(lockSet), writeBuf_(writeBuf), localBuf_(), localM_() {
+    }
+    template <typename Data>
+    bool read(TpccRecord<Mutex, Data>& rec, Data& local) {
+        std::unordered_map<uintptr_t, size_t>::const_iterator it = localM_.find(uintptr_t(&rec.mutex));
+        if (it != localM_.end()) {
+            ::memcpy(&local, &localBuf_[it->second], sizeof(Data));
+            return true;
+        }
+        // Not in the read set, so readFunc will be called.
+        lockSet_.read(rec.mutex, [&]() {
+                ::memcpy(&local, &rec.data, sizeof(Data));
+                cache(rec, local);
+            });
+        return true;
+    }
+    template <typename Data>
+    bool write(TpccRecord<Mutex, Data>& rec, const Data& local) {
+        lockSet_.write(rec.mutex);
+        writeBuf_.add(rec.data, local);
+        cache(rec, local);
+        return true;
+    }
+    /**
+     * Call this at the end of each trial.
+     */
+    void clear() {
+        localBuf_.clear();
+        localM_.clear();
+    }
+    /**
+     * Scanned leaves are added to the node set for phantom protection.
+     */
+    template <typename Func>
+    bool scan(cybozu::index::BTree& index, uint64_t lo, uint64_t hi, Func&& func) {
+        index.scan(lo, hi, std::forward<Func>(func), [&](const uint64_t& versionWord, uint64_t version) {
+            lockSet_.addNode(versionWord, version);
+        });
+        return true;
+    }
+    void insert(cybozu::index::BTree& index, uint64_t key, uint64_t value) {
+        writeBuf_.addIndexInsert(index, key, value);
+    }
+    void erase(cybozu::index::BTree& index, uint64_t key) {
+        writeBuf_.addIndexErase(index, key);
+    }
+private:
+    template <typename Data>
+    void cache(TpccRecord<Mutex, Data>& rec, const Data& local) {
+        std::pair<std::unordered_map<uintptr_t, size_t>::iterator, bool> ret =
+            localM_.emplace(uintptr_t(&rec.mutex), localBuf_.size());
+        if (ret.second) localBuf_.resize(localBuf_.size() + sizeof(Data));
+        ::memcpy(&localBuf_[ret.first->second], &local, sizeof(Data));
+    }
+};
+
+
+Result tpccWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    TpccTables<Mutex>& db = shared.tpcc;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    TpccTxGenerator<decltype(rand)> tpccGen(rand, db.nrWh, idx % db.nrWh);
+    TpccNewOrderIn newOrderIn;
+    TpccPaymentIn paymentIn;
+    TpccOrderStatusIn orderStatusIn;
+    TpccStockLevelIn stockLevelIn;
+    std::vector<TpccHistory> historyV(TPCC_NR_ORDER_SLOT_PER_DIST); // ring.
+    size_t historyPos = 0;
+
+    cybozu::occ::LockSet lockSet;
+    TpccWriteBuffer writeBuf;
+    OccTpccTx tx(lockSet, writeBuf);
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        const TpccTxType txType = tpccGen.chooseType();
+        switch (txType) {
+        case TpccTxType::NEW_ORDER:
+            tpccGen.fill(newOrderIn);
+            break;
+        case TpccTxType::PAYMENT:
+            tpccGen.fill(paymentIn);
+            break;
+        case TpccTxType::ORDER_STATUS:
+            tpccGen.fill(orderStatusIn);
+            break;
+        case TpccTxType::STOCK_LEVEL:
+            tpccGen.fill(stockLevelIn);
+            break;
+        }
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            // Try to run transaction.
+            assert(lockSet.empty());
+
+            TpccHistory& h = historyV[historyPos % historyV.size()];
+            bool ok = false;
+            switch (txType) {
+            case TpccTxType::NEW_ORDER:
+                ok = runTpccNewOrder(tx, db, newOrderIn, ::time(0));
+                break;
+            case TpccTxType::PAYMENT:
+                ok = runTpccPayment(tx, db, paymentIn, h);
+                break;
+            case TpccTxType::ORDER_STATUS:
+                ok = runTpccOrderStatus(tx, db, orderStatusIn);
+                break;
+            case TpccTxType::STOCK_LEVEL:
+                ok = runTpccStockLevel(tx, db, stockLevelIn);
+                break;
+            }
+
+            // commit phase.
+            if (ok) {
+                lockSet.lock();
+                writeBuf.applyIndex();
+                ok = lockSet.verify();
+                if (!ok) writeBuf.undoIndex();
+            }
+            if (!ok) {
+                lockSet.clear();
+                writeBuf.clear();
+                tx.clear();
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                continue;
+            }
+            writeBuf.apply();
+            lockSet.updateAndUnlock();
+            writeBuf.clear();
+            tx.clear();
+            if (txType == TpccTxType::PAYMENT) historyPos++;
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+    }
+    return res;
+}
+
+enum class InsOpType : uint8_t { READ, UPDATE, INSERT, DELETE, };
+
+struct InsOp
+{
+    InsOpType type;
+    uint64_t key;
+    size_t slot; // for INSERT and DELETE.
+};
+
+
+/**
+ * Transactions with inserts and deletes through the index.
+ * Slots removed from the index are reused after the epoch-based reclamation,
+ * so records found by the index have the keys.
+ */
+Result insertWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    using KeyWindow = Shared::KeyWindow;
+
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<uint64_t>& keyV = shared.keyV;
+    cybozu::index::BTree& index = shared.index;
+    const size_t nrOp = shared.nrOp;
+    const size_t nrTh = shared.windowV.size();
+    KeyWindow& win = shared.windowV[idx];
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    std::vector<InsOp> opV;
+    LocalSlotAllocator& slotAlloc = *shared.slotAllocV[idx];
+    cybozu::epoch::EpochManager& ebr = *epochManagerOfThisThread();
+    auto retireSlot = [&](size_t slot) {
+        ebr.retire(idx, [](void *ctx, uintptr_t v) { static_cast<LocalSlotAllocator *>(ctx)->free(v); },
+                   &slotAlloc, slot, sizeof(Mutex) + sizeof(uint64_t));
+    };
+    // Undo inserts of opV[0, n).
+    auto undoInserts = [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            const InsOp& op = opV[i];
+            if (op.type != InsOpType::INSERT) continue;
+            index.erase(op.key);
+            retireSlot(op.slot); // others may have found it.
+        }
+    };
+
+    cybozu::occ::LockSet lockSet;
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        opV.clear();
+        size_t nrIns = 0, nrDel = 0;
+        for (size_t i = 0; i < nrOp; i++) {
+            const size_t pct = rand() % 100;
+            if (pct < shared.insPct) {
+                opV.push_back(InsOp{InsOpType::INSERT, (win.hi + nrIns) * nrTh + idx, 0});
+                nrIns++;
+            } else if (pct < shared.insPct * 2 && win.lo + nrDel < win.hi) {
+                opV.push_back(InsOp{InsOpType::DELETE, (win.lo + nrDel) * nrTh + idx, 0});
+                nrDel++;
+            } else {
+                const size_t t = rand() % nrTh;
+                const uint64_t lo = __atomic_load_n(&shared.windowV[t].lo, __ATOMIC_RELAXED);
+                const uint64_t hi = __atomic_load_n(&shared.windowV[t].hi, __ATOMIC_RELAXED);
+                if (lo >= hi) continue;
+                const uint64_t key = (lo + rand() % (hi - lo)) * nrTh + t;
+                opV.push_back(InsOp{pct % 2 == 0 ? InsOpType::READ : InsOpType::UPDATE, key, 0});
+            }
+        }
+
+        res.beginTx();
+        ebr.enter(idx);
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            // Try to run transaction.
+            assert(lockSet.empty());
+
+            size_t nrDone = 0;
+            for (InsOp& op : opV) {
+                nrDone++;
+                if (op.type == InsOpType::INSERT) {
+                    if (!slotAlloc.tryAlloc(op.slot)) {
+                        nrDone--;
+                        break;
+                    }
+                    // The record is visible in the index as an absent one until commit.
+                    const bool ret = index.insert(op.key, op.slot);
+                    unused(ret);
+                    assert(ret);
+                    lockSet.insert(muV[op.slot]);
+                    continue;
+                }
+                uint64_t slot = 0;
+                if (!index.lookup(op.key, slot)) continue; // not found.
+                uint64_t key = op.key; // readFunc is not called if the record has been read already.
+                if (!lockSet.read(muV[slot], [&]() { key = keyV[slot]; })) continue; // not found.
+                unused(key);
+                assert(key == op.key);
+                if (op.type == InsOpType::UPDATE) {
+                    lockSet.write(muV[slot]);
+                } else if (op.type == InsOpType::DELETE) {
+                    op.slot = slot;
+                    lockSet.remove(muV[slot]);
+                }
+            }
+            if (nrDone < opV.size()) {
+                // Slots are in limbo lists. Leave the epoch to reclaim them.
+                undoInserts(nrDone);
+                lockSet.clear();
+                ebr.leave(idx);
+                ebr.tryAdvance();
+                ebr.reclaim(idx);
+                ebr.enter(idx);
+                continue;
+            }
+
+            // commit phase.
+            lockSet.lock();
+            if (!lockSet.verify()) {
+                undoInserts(opV.size());
+                lockSet.clear();
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                continue;
+            }
+            for (const InsOp& op : opV) {
+                if (op.type == InsOpType::INSERT) keyV[op.slot] = op.key;
+            }
+            lockSet.updateAndUnlock();
+            // Deleted records are removed from the index after commit.
+            for (const InsOp& op : opV) {
+                if (op.type != InsOpType::DELETE) continue;
+                index.erase(op.key);
+                retireSlot(op.slot);
+            }
+            __atomic_store_n(&win.hi, win.hi + nrIns, __ATOMIC_RELAXED);
+            __atomic_store_n(&win.lo, win.lo + nrDel, __ATOMIC_RELAXED);
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+        ebr.leave(idx);
+    }
+    return res;
+}
+
+
 void runTest()
 {
 #if 0
@@ -299,10 +758,14 @@ struct CmdLineOptionPlus : CmdLineOption
 {
     using base = CmdLineOption;
 
+    bool useMvcc;
+
     CmdLineOptionPlus(const std::string& description) : CmdLineOption(description) {
+        appendBoolOpt(&useMvcc, "mvcc", ": read-only long transactions (-lm 2) read snapshots of versions in custom workload.");
     }
     std::string str() const {
-        return cybozu::util::formatString("mode:silo-occ ") + base::str();
+        return cybozu::util::formatString("mode:silo-occ ") + base::str()
+            + cybozu::util::formatString(" mvcc:%d", useMvcc);
     }
 };
 
@@ -311,6 +774,7 @@ int main(int argc, char *argv[]) try
 {
     CmdLineOptionPlus opt("occ_bench: benchmark with silo-occ.");
     opt.parse(argc, argv);
+    cybozu::occ::EpochAdvancer epochAdvancer;
 
     if (opt.workload == "custom") {
         Shared shared;
@@ -320,9 +784,68 @@ int main(int argc, char *argv[]) try
         shared.nrWr = opt.nrWr;
         shared.shortTxMode = opt.shortTxMode;
         shared.longTxMode = opt.longTxMode;
+        shared.useMvcc = opt.useMvcc;
+        if (opt.useMvcc) shared.versionS.init(opt.getNrMu(), opt.nrTh);
         for (size_t i = 0; i < opt.nrLoop; i++) {
             runExec(opt, shared, worker2);
         }
+    } else if (isYcsbWorkload(opt.workload)) {
+        Shared shared;
+        shared.muV.resize(opt.getNrMu());
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, ycsbWorker);
+        }
+    } else if (opt.workload == "tpcc") {
+        Shared shared;
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        cybozu::util::Xoroshiro128Plus rand(::time(0));
+        shared.tpcc.init(opt.nrWh, rand);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, tpccWorker);
+        }
+    } else if (opt.workload == "insert") {
+        Shared shared;
+        const size_t nrMu = opt.getNrMu();
+        // Slots for inserted records. Deleted ones are reused.
+        const size_t nrSlot = nrMu * 2 + opt.nrTh * 1024;
+        shared.muV.resize(nrSlot);
+        shared.keyV.resize(nrSlot);
+        for (size_t i = 0; i < nrSlot; i++) {
+            if (i < nrMu) {
+                shared.keyV[i] = i;
+                shared.index.insert(i, i);
+            } else {
+                shared.muV[i].lockD.setAbsent(true);
+            }
+        }
+        shared.slotPool.init(nrMu, nrSlot);
+        for (size_t i = 0; i < opt.nrTh; i++) {
+            shared.slotAllocV.emplace_back(new LocalSlotAllocator(shared.slotPool));
+        }
+        shared.windowV.resize(opt.nrTh);
+        for (size_t i = 0; i < opt.nrTh; i++) {
+            shared.windowV[i].lo = 0;
+            shared.windowV[i].hi = nrMu / opt.nrTh + (i < nrMu % opt.nrTh ? 1 : 0);
+        }
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.insPct = opt.insPct;
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, insertWorker);
+        }
     } else {
         throw cybozu::Exception("bad workload.") << opt.workload;
     }
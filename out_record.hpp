@@ -0,0 +1,244 @@
+#pragma once
+/*
+ * Structured result of a run for -out json|csv.
+ *
+ * A record is an ordered tree of objects, arrays and scalars.
+ * json: a record is put in one line.
+ * csv: a record is flattened to one row whose columns are joined paths
+ *      like "result.commitS". Compact nodes are put in one cell like "k=v;k=v".
+ *      The header is put only when it differs from the previous one.
+ */
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "cybozu/exception.hpp"
+#include "util.hpp"
+
+
+class OutRecord
+{
+public:
+    enum class Type : uint8_t { NUL, NUMBER, STRING, OBJECT, ARRAY, };
+
+private:
+    std::string key_;
+    Type type_;
+    std::string value_; // for NUMBER and STRING.
+    bool compact_; // put in one csv cell.
+    std::vector<OutRecord> children_;
+
+public:
+    explicit OutRecord(const std::string& key = "", Type type = Type::OBJECT, bool compact = false)
+        : key_(key), type_(type), value_(), compact_(compact), children_() {
+    }
+    /**
+     * Add a child object or array and return it.
+     * For arrays, key is ignored.
+     * The reference is valid until the next child is added to this.
+     */
+    OutRecord& addObject(const std::string& key, bool compact = false) {
+        return addChild(key, Type::OBJECT, compact);
+    }
+    OutRecord& addArray(const std::string& key, bool compact = false) {
+        return addChild(key, Type::ARRAY, compact);
+    }
+    void addNumber(const std::string& key, size_t v) {
+        addChild(key, Type::NUMBER).value_ = cybozu::util::formatString("%zu", v);
+    }
+    void addNumber(const std::string& key, double v) {
+        addChild(key, Type::NUMBER).value_ = cybozu::util::formatString("%.3f", v);
+    }
+    void addString(const std::string& key, const std::string& v) {
+        addChild(key, Type::STRING).value_ = v;
+    }
+    void addNull(const std::string& key) {
+        addChild(key, Type::NUL);
+    }
+    void addRecord(const std::string& key, const OutRecord& rec) {
+        OutRecord& child = addChild(key, rec.type_, rec.compact_);
+        child.value_ = rec.value_;
+        child.children_ = rec.children_;
+    }
+    /**
+     * Numbers are put as numbers and the others as strings.
+     */
+    void addValue(const std::string& key, const std::string& v) {
+        if (isNumber(v)) {
+            addChild(key, Type::NUMBER).value_ = v;
+        } else {
+            addString(key, v);
+        }
+    }
+    /**
+     * Add "key:value" tokens separated by spaces like CmdLineOption::str().
+     * "-" value means null.
+     */
+    void addKeyValueTokens(const std::string& s) {
+        size_t i = 0;
+        while (i < s.size()) {
+            size_t j = s.find(' ', i);
+            if (j == std::string::npos) j = s.size();
+            const std::string token = s.substr(i, j - i);
+            i = j + 1;
+            if (token.empty()) continue;
+            const size_t k = token.find(':');
+            if (k == std::string::npos) {
+                throw cybozu::Exception("OutRecord: bad token") << token;
+            }
+            const std::string v = token.substr(k + 1);
+            if (v == "-") {
+                addNull(token.substr(0, k));
+            } else {
+                addValue(token.substr(0, k), v);
+            }
+        }
+    }
+
+    std::string json() const {
+        std::string s;
+        putJson(s);
+        return s;
+    }
+    /**
+     * header and row of the record without newlines.
+     */
+    void csv(std::string& header, std::string& row) const {
+        std::vector<std::string> keys, values;
+        flatten("", keys, values);
+        header.clear();
+        row.clear();
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (i != 0) {
+                header += ',';
+                row += ',';
+            }
+            header += csvCell(keys[i]);
+            row += csvCell(values[i]);
+        }
+    }
+    /**
+     * format: "json" or "csv".
+     */
+    void put(const std::string& format, ::FILE *fp = ::stdout) const {
+        if (format == "json") {
+            ::fprintf(fp, "%s\n", json().c_str());
+        } else if (format == "csv") {
+            static std::string prevHeader;
+            std::string header, row;
+            csv(header, row);
+            if (header != prevHeader) {
+                ::fprintf(fp, "%s\n", header.c_str());
+                prevHeader = header;
+            }
+            ::fprintf(fp, "%s\n", row.c_str());
+        } else {
+            throw cybozu::Exception("OutRecord: bad format") << format;
+        }
+        ::fflush(fp);
+    }
+
+private:
+    OutRecord& addChild(const std::string& key, Type type, bool compact = false) {
+        if (type_ != Type::OBJECT && type_ != Type::ARRAY) {
+            throw cybozu::Exception("OutRecord: not a container") << key_;
+        }
+        children_.emplace_back(type_ == Type::ARRAY ? "" : key, type, compact);
+        return children_.back();
+    }
+    static bool isNumber(const std::string& s) {
+        // not to accept "inf", "nan", "0x10" etc. that json does not allow.
+        if (s.empty() || s.find_first_not_of("0123456789.eE+-") != std::string::npos) return false;
+        char *end;
+        ::strtod(s.c_str(), &end);
+        return *end == '\0';
+    }
+    static void putJsonString(std::string& out, const std::string& s) {
+        out += '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if ((unsigned char)c < 0x20) {
+                out += cybozu::util::formatString("\\u%04x", c);
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+    void putJson(std::string& out) const {
+        switch (type_) {
+        case Type::NUL:
+            out += "null";
+            break;
+        case Type::NUMBER:
+            out += value_;
+            break;
+        case Type::STRING:
+            putJsonString(out, value_);
+            break;
+        case Type::OBJECT:
+        case Type::ARRAY:
+            out += type_ == Type::OBJECT ? '{' : '[';
+            for (size_t i = 0; i < children_.size(); i++) {
+                if (i != 0) out += ',';
+                if (type_ == Type::OBJECT) {
+                    putJsonString(out, children_[i].key_);
+                    out += ':';
+                }
+                children_[i].putJson(out);
+            }
+            out += type_ == Type::OBJECT ? '}' : ']';
+            break;
+        }
+    }
+    /**
+     * Object: "k=v;k=v", array: "v|v".
+     */
+    std::string compactStr() const {
+        switch (type_) {
+        case Type::NUL:
+            return "";
+        case Type::NUMBER:
+        case Type::STRING:
+            return value_;
+        case Type::OBJECT:
+        case Type::ARRAY:
+        default:
+            break;
+        }
+        std::string s;
+        for (size_t i = 0; i < children_.size(); i++) {
+            if (i != 0) s += type_ == Type::OBJECT ? ';' : '|';
+            if (type_ == Type::OBJECT) {
+                s += children_[i].key_;
+                s += '=';
+            }
+            s += children_[i].compactStr();
+        }
+        return s;
+    }
+    void flatten(const std::string& path, std::vector<std::string>& keys, std::vector<std::string>& values) const {
+        if ((type_ != Type::OBJECT && type_ != Type::ARRAY) || compact_) {
+            keys.push_back(path);
+            values.push_back(compactStr());
+            return;
+        }
+        for (size_t i = 0; i < children_.size(); i++) {
+            const std::string name = type_ == Type::OBJECT
+                ? children_[i].key_ : cybozu::util::formatString("%zu", i);
+            children_[i].flatten(path.empty() ? name : path + "." + name, keys, values);
+        }
+    }
+    static std::string csvCell(const std::string& s) {
+        if (s.find_first_of(",\"\n") == std::string::npos) return s;
+        std::string ret = "\"";
+        for (char c : s) {
+            if (c == '"') ret += '"';
+            ret += c;
+        }
+        ret += '"';
+        return ret;
+    }
+};
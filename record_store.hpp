@@ -0,0 +1,250 @@
+#pragma once
+/*
+ * Records with fixed-size payloads and their mutexes for the *_bench programs.
+ * The i-th record is protected by the i-th mutex.
+ *
+ * The layout is selected at runtime so that false sharing and footprint
+ * can be measured with one binary.
+ * Mutex types must not be padded by themselves (MUTEX_ON_CACHELINE undefined)
+ * to use the packed layouts.
+ */
+#include <new>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "cybozu/exception.hpp"
+#include "huge_page.hpp"
+
+
+enum class RecordLayout : uint8_t
+{
+    PACKED = 0, // lock table with packed lock words, separated from records.
+    PADDED, // lock table with a lock word per cache line, separated from records.
+    EMBEDDED, // lock word in the record header.
+    EMBEDDED_PADDED, // lock word in the record header, records aligned to cache lines.
+    MAX,
+};
+
+
+inline const char* recordLayoutStr(RecordLayout layout)
+{
+    static const char *const tbl[] = {
+        "packed", "padded", "embedded", "embedded-padded",
+    };
+    static_assert(sizeof(tbl) / sizeof(tbl[0]) == size_t(RecordLayout::MAX), "recordLayoutStr: bad table size.");
+    return tbl[size_t(layout)];
+}
+
+
+inline RecordLayout parseRecordLayout(const std::string& s)
+{
+    for (size_t i = 0; i < size_t(RecordLayout::MAX); i++) {
+        if (s == recordLayoutStr(RecordLayout(i))) return RecordLayout(i);
+    }
+    throw cybozu::Exception("parseRecordLayout: bad layout") << s;
+}
+
+
+template <typename Mutex>
+class RecordStore
+{
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+    static constexpr size_t ALIGN = 8;
+    static_assert(alignof(Mutex) <= CACHE_LINE_SIZE, "RecordStore: too large alignment.");
+
+    RecordLayout layout_;
+    size_t nrRec_;
+    size_t payloadSize_;
+    size_t muStride_; // stride of muBuf_. It contains payloads also if embedded.
+    size_t recStride_; // stride of recBuf_.
+    size_t recOffset_; // offset of payload in a record if embedded.
+    cybozu::huge_page::Vector<char> muBuf_; // aligned to cache lines.
+    cybozu::huge_page::Vector<char> recBuf_; // not used if embedded.
+
+public:
+    RecordStore()
+        : layout_(RecordLayout::PADDED), nrRec_(0), payloadSize_(0)
+        , muStride_(0), recStride_(0), recOffset_(0), muBuf_(), recBuf_() {
+    }
+    ~RecordStore() noexcept {
+        destroy();
+    }
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
+
+    /**
+     * payloadSize 0 means mutexes only.
+     */
+    void init(size_t nrRec, size_t payloadSize, RecordLayout layout) {
+        destroy();
+        layout_ = layout;
+        nrRec_ = nrRec;
+        payloadSize_ = payloadSize;
+        const size_t muAlign = std::max(ALIGN, alignof(Mutex));
+        switch (layout) {
+        case RecordLayout::PACKED:
+            muStride_ = sizeof(Mutex);
+            recStride_ = roundUp(payloadSize, ALIGN);
+            break;
+        case RecordLayout::PADDED:
+            muStride_ = roundUp(sizeof(Mutex), CACHE_LINE_SIZE);
+            recStride_ = roundUp(payloadSize, ALIGN);
+            break;
+        case RecordLayout::EMBEDDED:
+            recOffset_ = roundUp(sizeof(Mutex), ALIGN);
+            muStride_ = roundUp(recOffset_ + payloadSize, muAlign);
+            recStride_ = 0;
+            break;
+        case RecordLayout::EMBEDDED_PADDED:
+            recOffset_ = roundUp(sizeof(Mutex), ALIGN);
+            muStride_ = roundUp(recOffset_ + payloadSize, CACHE_LINE_SIZE);
+            recStride_ = 0;
+            break;
+        default:
+            throw cybozu::Exception("RecordStore: bad layout") << int(layout);
+        }
+        muBuf_.clear();
+        muBuf_.resize(nrRec * muStride_);
+        recBuf_.clear();
+        recBuf_.resize(nrRec * recStride_);
+        for (size_t i = 0; i < nrRec; i++) {
+            new (&muBuf_[i * muStride_]) Mutex();
+        }
+    }
+    size_t size() const { return nrRec_; }
+    size_t payloadSize() const { return payloadSize_; }
+    RecordLayout layout() const { return layout_; }
+    /**
+     * Total bytes of the mutexes and the records.
+     */
+    size_t footprint() const { return nrRec_ * (muStride_ + recStride_); }
+
+    Mutex& mutex(size_t idx) {
+        return *reinterpret_cast<Mutex *>(&muBuf_[idx * muStride_]);
+    }
+    char *get(size_t idx) {
+        if (isEmbedded()) return &muBuf_[idx * muStride_ + recOffset_];
+        return &recBuf_[idx * recStride_];
+    }
+
+private:
+    bool isEmbedded() const {
+        return layout_ == RecordLayout::EMBEDDED || layout_ == RecordLayout::EMBEDDED_PADDED;
+    }
+    static size_t roundUp(size_t v, size_t align) {
+        return (v + align - 1) / align * align;
+    }
+    void destroy() {
+        for (size_t i = 0; i < nrRec_; i++) {
+            mutex(i).~Mutex();
+        }
+        nrRec_ = 0;
+    }
+};
+
+
+/**
+ * Writes of a transaction buffered in its local memory.
+ * They are installed to the records at commit time.
+ */
+class RecordWriteBuffer
+{
+    struct Entry
+    {
+        char *dst;
+        const char *src;
+    };
+    std::vector<Entry> entryV_;
+    size_t size_;
+
+public:
+    explicit RecordWriteBuffer(size_t payloadSize) : entryV_(), size_(payloadSize) {}
+    /**
+     * src must be kept until apply() or clear().
+     */
+    void add(char *dst, const char *src) {
+        entryV_.push_back(Entry{dst, src});
+    }
+    void apply() const {
+        for (const Entry& e : entryV_) {
+            ::memcpy(e.dst, e.src, size_);
+        }
+    }
+    void clear() {
+        entryV_.clear();
+    }
+};
+
+
+/**
+ * Shared pool of record slots in [begin, end).
+ * Slots are handed out in chunks so that workers rarely touch the shared counter.
+ */
+class SlotPool
+{
+    alignas(64)
+    size_t next_;
+    size_t end_;
+
+public:
+    SlotPool() : next_(0), end_(0) {}
+    void init(size_t begin, size_t end) {
+        next_ = begin;
+        end_ = end;
+    }
+    /**
+     * RETURN:
+     *   false if the pool is exhausted.
+     */
+    bool allocChunk(size_t chunkSize, size_t& begin, size_t& end) {
+        const size_t b = __atomic_fetch_add(&next_, chunkSize, __ATOMIC_RELAXED);
+        if (b >= end_) return false;
+        begin = b;
+        end = std::min(b + chunkSize, end_);
+        return true;
+    }
+};
+
+
+/**
+ * Per-worker slot allocator.
+ * Freed slots are reused by the same worker.
+ * The caller must make sure that nobody will be confused by the reuse,
+ * for example by freeing slots through EpochManager (epoch.hpp).
+ */
+class LocalSlotAllocator
+{
+    static constexpr size_t CHUNK_SIZE = 64;
+
+    SlotPool& pool_;
+    size_t next_;
+    size_t end_;
+    std::vector<size_t> freeV_;
+
+public:
+    explicit LocalSlotAllocator(SlotPool& pool) : pool_(pool), next_(0), end_(0), freeV_() {}
+    /**
+     * RETURN:
+     *   false if no slot is available now.
+     */
+    bool tryAlloc(size_t& slot) {
+        if (!freeV_.empty()) {
+            slot = freeV_.back();
+            freeV_.pop_back();
+            return true;
+        }
+        if (next_ == end_ && !pool_.allocChunk(CHUNK_SIZE, next_, end_)) return false;
+        slot = next_++;
+        return true;
+    }
+    size_t alloc() {
+        size_t slot;
+        if (!tryAlloc(slot)) throw cybozu::Exception("LocalSlotAllocator: no more slot");
+        return slot;
+    }
+    void free(size_t slot) {
+        freeV_.push_back(slot);
+    }
+};
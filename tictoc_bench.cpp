@@ -7,6 +7,7 @@
 #include "random.hpp"
 #include "measure_util.hpp"
 #include "cpuid.hpp"
+#include "ycsb.hpp"
 
 using Mutex = cybozu::tictoc::Mutex;
 
@@ -15,12 +16,13 @@ const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
 
 struct Shared
 {
-    std::vector<Mutex> muV;
+    cybozu::huge_page::Vector<Mutex> muV;
     size_t longTxSize;
     size_t nrOp;
     size_t nrWr;
     int shortTxMode;
     int longTxMode;
+    YcsbParam ycsbParam;
 };
 
 
@@ -32,7 +34,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -85,6 +87,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
             }
         }
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             // Try to run transaction.
@@ -107,7 +110,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
                 }
             }
             if (!cybozu::tictoc::preCommit(rs, ws, ls, flags)) {
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
                 continue;
             }
             res.incCommit(isLongTx);
@@ -133,7 +136,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -169,6 +172,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             fillModeVec(isWriteV, rand, nrWr, tmpV2);
         }
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             // Try to run transaction.
@@ -182,7 +186,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             }
             if (!localSet.preCommit()) {
                 localSet.clear();
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
                 continue;
             }
             res.incCommit(isLongTx);
@@ -194,6 +198,51 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
 }
 
 
+Result ycsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+{
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+    cybozu::tictoc::LocalSet localSet;
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            // Try to run transaction.
+            for (const YcsbAccess& acc : accV) {
+                Mutex& mutex = muV[acc.key];
+                if (acc.isRead()) {
+                    localSet.read(mutex);
+                }
+                if (acc.isWrite()) {
+                    localSet.write(mutex);
+                }
+            }
+            if (!localSet.preCommit()) {
+                localSet.clear();
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                continue;
+            }
+            res.incCommit(isLongTx);
+            res.addRetryCount(isLongTx, retry);
+            break;
+        }
+    }
+    return res;
+}
+
 void runTest()
 {
 #if 0
@@ -283,6 +332,18 @@ int main(int argc, char *argv[]) try
         for (size_t i = 0; i < opt.nrLoop; i++) {
             runExec(opt, shared, worker2);
         }
+    } else if (isYcsbWorkload(opt.workload)) {
+        Shared shared;
+        shared.muV.resize(opt.getNrMu());
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            runExec(opt, shared, ycsbWorker);
+        }
     } else {
         throw cybozu::Exception("bad workload.") << opt.workload;
     }
@@ -12,6 +12,7 @@
 #include "lock.hpp"
 #include "trlock.hpp"
 #include "cmdline_option.hpp"
+#include "ycsb.hpp"
 
 
 using Spinlock = cybozu::lock::TtasSpinlockT<0>;
@@ -274,7 +275,7 @@ struct TLockShared
 {
     using Mutex = typename TLockTypes<PQLock>::Mutex;
 
-    std::vector<Mutex> muV;
+    cybozu::huge_page::Vector<Mutex> muV;
     ReadMode rmode;
     TxInfo txInfo;
     size_t longTxSize;
@@ -301,7 +302,7 @@ Result tWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const ReadMode rmode = shared.rmode;
     TxInfo& txInfo = shared.txInfo;
     unused(txInfo);
@@ -383,6 +384,7 @@ Result tWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             throw cybozu::Exception("bad txIdGenType") << txIdGenType;
         }
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(writeLocks.empty());
@@ -455,7 +457,7 @@ Result tWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
 #if 0 // preemptive aborts
             for (TLockReader& r : readSet) {
                 if (!r.verifyAll()) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::VALIDATION);
                     goto abort;
                 }
             }
@@ -520,7 +522,7 @@ Result tWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
                              , r.getLockData().str().c_str()
                              , lockD.str().c_str()); // debug
 #endif
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::VALIDATION);
                     goto abort;
                 } else {
 #if 0
@@ -577,7 +579,7 @@ Result tWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
 
 
 template <typename TxIdGen, typename TLockTypes>
-Result readWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, std::vector<typename TLockTypes::Mutex>& muV, TxIdGen& txIdGen, ReadMode rmode, __attribute__((unused)) TxInfo& txInfo)
+Result readWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, cybozu::huge_page::Vector<typename TLockTypes::Mutex>& muV, TxIdGen& txIdGen, ReadMode rmode, __attribute__((unused)) TxInfo& txInfo)
 {
     using TLock = typename TLockTypes::TLock;
     using TLockReader = typename TLockTypes::TLockReader;
@@ -604,6 +606,7 @@ Result readWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQ
 
         const uint32_t txId = txIdGen.get();
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             //bool abort = false;
@@ -644,7 +647,7 @@ Result readWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQ
             for (TLockReader& r : readSet) {
                 const bool ret = r.verifyAll();
                 if (!ret) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::VALIDATION);
                     goto abort;
                 }
             }
@@ -665,7 +668,7 @@ Result readWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQ
 }
 
 template <typename TxIdGen, typename TLockTypes>
-Result contentionWorker(size_t idx, const bool& start, const bool& quit, std::vector<typename TLockTypes::Mutex>& muV, TxIdGen& txIdGen, ReadMode rmode, size_t nrOp, size_t nrWr)
+Result contentionWorker(size_t idx, const bool& start, const bool& quit, cybozu::huge_page::Vector<typename TLockTypes::Mutex>& muV, TxIdGen& txIdGen, ReadMode rmode, size_t nrOp, size_t nrWr)
 {
     using Mutex = typename TLockTypes::Mutex;
     using TLock = typename TLockTypes::TLock;
@@ -704,6 +707,7 @@ Result contentionWorker(size_t idx, const bool& start, const bool& quit, std::ve
         unused(sz);
         const uint32_t txId = txIdGen.get();
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(writeLocks.empty());
@@ -781,7 +785,7 @@ Result contentionWorker(size_t idx, const bool& start, const bool& quit, std::ve
                     (!writeSet.empty() && std::binary_search(writeSet.begin(), writeSet.end(), r.getMutexId()))
                     ? r.verifyVersion() : r.verifyAll();
                 if (!ret) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::VALIDATION);
                     goto abort;
                 }
             }
@@ -817,13 +821,14 @@ struct ILockShared
 {
     using IMutex = typename ILockTypes<PQLock>::IMutex;
 
-    std::vector<IMutex> muV;
+    cybozu::huge_page::Vector<IMutex> muV;
     ReadMode rmode;
     size_t longTxSize;
     size_t nrOp;
     size_t nrWr;
     int shortTxMode;
     int longTxMode;
+    YcsbParam ycsbParam;
 
     GlobalTxIdGenerator globalTxIdGen;
     SimpleTxIdGenerator simpleTxIdGen;
@@ -850,7 +855,7 @@ Result iWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
     priIdGen.init(idx + 1);
     TxIdGenerator localTxIdGen(&shared.globalTxIdGen);
 
-    std::vector<IMutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<IMutex>& muV = shared.muV;
     const ReadMode rmode = shared.rmode;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
@@ -919,6 +924,7 @@ Result iWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
         }
         //::printf("worker %zu priId: %" PRIx64 "\n", idx, priId);
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(writeLocks.empty());
@@ -1002,7 +1008,7 @@ Result iWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
                              , r.getLockData().str().c_str()
                              , lockD.str().c_str()); // debug
 #endif
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::VALIDATION);
                     goto abort;
                 } else {
 #if 0
@@ -1066,7 +1072,7 @@ Result iWorker2(size_t idx, const bool& start, const bool& quit, bool& shouldQui
     priIdGen.init(idx + 1);
     TxIdGenerator localTxIdGen(&shared.globalTxIdGen);
 
-    std::vector<IMutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<IMutex>& muV = shared.muV;
     const ReadMode rmode = shared.rmode;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
@@ -1120,6 +1126,7 @@ Result iWorker2(size_t idx, const bool& start, const bool& quit, bool& shouldQui
         assert(lockSet.isEmpty());
         lockSet.setPriorityId(priId);
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
 
@@ -1141,7 +1148,7 @@ Result iWorker2(size_t idx, const bool& start, const bool& quit, bool& shouldQui
                     assert(ret);
                 } else if (mode == IMode::S) {
                     if (!lockSet.pessimisticRead(mutex)) {
-                        res.incAbort(isLongTx);
+                        res.incAbort(isLongTx, AbortReason::VALIDATION);
                         goto abort;
                     }
                 }
@@ -1155,7 +1162,7 @@ Result iWorker2(size_t idx, const bool& start, const bool& quit, bool& shouldQui
                         assert(ret);
                     } else {
                         if (!lockSet.pessimisticRead(mutex)) {
-                            res.incAbort(isLongTx);
+                            res.incAbort(isLongTx, AbortReason::VALIDATION);
                             goto abort;
                         }
                     }
@@ -1177,7 +1184,7 @@ Result iWorker2(size_t idx, const bool& start, const bool& quit, bool& shouldQui
                 goto abort;
             }
             if (!lockSet.verify()) {
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
                 goto abort;
             }
 
@@ -1200,6 +1207,106 @@ Result iWorker2(size_t idx, const bool& start, const bool& quit, bool& shouldQui
 
 
 
+/**
+ * Using ILock with YCSB workloads.
+ */
+template <int txIdGenType, typename PQLock>
+Result iYcsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, ILockShared<PQLock>& shared)
+{
+    using IMutex = typename ILockTypes<PQLock>::IMutex;
+
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    PriorityIdGenerator<12> priIdGen;
+    priIdGen.init(idx + 1);
+    TxIdGenerator localTxIdGen(&shared.globalTxIdGen);
+
+    cybozu::huge_page::Vector<IMutex>& muV = shared.muV;
+    const ReadMode rmode = shared.rmode;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+
+    const bool isLongTx = false;
+    cybozu::lock::ILockSet<PQLock> lockSet;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+
+        uint64_t priId;
+        if (txIdGenType == SCALABLE_TXID_GEN) {
+            priId = priIdGen.get(1);
+        } else if (txIdGenType == BULK_TXID_GEN) {
+            priId = localTxIdGen.get();
+        } else if (txIdGenType == SIMPLE_TXID_GEN) {
+            priId = shared.simpleTxIdGen.get();
+        } else {
+            throw cybozu::Exception("bad txIdGenType") << txIdGenType;
+        }
+
+        assert(lockSet.isEmpty());
+        lockSet.setPriorityId(priId);
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+
+            const bool tryOccRead = rmode == ReadMode::OCC
+                || (rmode == ReadMode::HYBRID && retry == 0);
+            for (const YcsbAccess& acc : accV) {
+                IMutex &mutex = muV[acc.key];
+                if (acc.isRead()) {
+                    if (tryOccRead) {
+                        bool ret = lockSet.optimisticRead(mutex);
+                        unused(ret);
+                        assert(ret);
+                    } else if (!acc.isWrite()) {
+                        if (!lockSet.pessimisticRead(mutex)) {
+                            res.incAbort(isLongTx, AbortReason::VALIDATION);
+                            goto abort;
+                        }
+                    }
+                }
+                if (acc.isWrite()) {
+                    if (!lockSet.write(mutex)) {
+                        res.incIntercepted(isLongTx);
+                        goto abort;
+                    }
+                }
+            }
+
+            // Pre-commit.
+            if (!lockSet.protect()) {
+                res.incIntercepted(isLongTx);
+                goto abort;
+            }
+            if (!lockSet.verify()) {
+                res.incAbort(isLongTx, AbortReason::VALIDATION);
+                goto abort;
+            }
+
+            // We can commit.
+            lockSet.updateAndUnlock();
+            res.incCommit(isLongTx);
+
+            // Tx succeeded.
+            res.addRetryCount(isLongTx, retry);
+            break;
+
+          abort:
+            lockSet.clear();
+        }
+    }
+
+    return res;
+}
+
+
 void runTest()
 {
 #if 0
@@ -1364,6 +1471,14 @@ struct Dispatch3<PQLock, 1, txIdGenType, Shared>
     }
 };
 
+template <typename PQLock, int txIdGenType, typename Shared>
+struct Dispatch3<PQLock, 2, txIdGenType, Shared>
+{
+    static void run(CmdLineOptionPlus& opt, Shared& shared) {
+        runExec(opt, shared, iYcsbWorker<txIdGenType, PQLock>);
+    }
+};
+
 template <typename PQLock, int workerType, typename Shared>
 void dispatch2(CmdLineOptionPlus& opt, Shared& shared)
 {
@@ -1410,6 +1525,19 @@ void dispatch1(CmdLineOptionPlus& opt)
         for (size_t i = 0; i < opt.nrLoop; i++) {
             dispatch2<PQLock, 1>(opt, shared);
         }
+    } else if (isYcsbWorkload(opt.workload)) {
+        ILockShared<PQLock> shared;
+        shared.muV.resize(opt.getNrMu());
+        shared.rmode = strToReadMode(opt.modeStr.c_str());
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            dispatch2<PQLock, 2>(opt, shared);
+        }
     } else {
         throw cybozu::Exception("bad workload.") << opt.workload;
     }
@@ -0,0 +1,661 @@
+#pragma once
+/*
+ * TPC-C NewOrder, Payment, OrderStatus and StockLevel transactions for the *_bench programs.
+ *
+ * Warehouse is the scaling unit. Each worker has its home warehouse (idx % nrWh).
+ * NewOrder: 1% of order lines are supplied by a remote warehouse.
+ * Payment: 15% of customers belong to a remote warehouse.
+ * The mix is NewOrder:Payment:OrderStatus:StockLevel = 45:43:4:4
+ * as the standard mix without Delivery.
+ *
+ * Our benchmarks do not support inserts, so order, new-order, and order-line tables
+ * are rings of fixed slots per district indexed by order id.
+ * Orders in the rings are found by range scans of ordered indexes, which
+ * NewOrder updates when it overwrites a slot.
+ * Customers are always selected by id (no last-name lookup).
+ * History is an insert-only table that nobody reads, so it is kept by each worker.
+ *
+ * A transaction procedure accesses records through a Tx object that has
+ *   bool read(Record& rec, Data& local)
+ *   bool write(Record& rec, const Data& local)
+ *   bool scan(Index& index, Key lo, Key hi, Func func)
+ *     func(Key key, Value value) for keys in [lo, hi). func returns false to stop.
+ *   void insert(Index& index, Key key, Value value)
+ *   void erase(Index& index, Key key)
+ *     index updates are deferred to the commit phase.
+ *     The record the key points to must be written by the transaction.
+ * If one of them returns false, the procedure returns false and the transaction must abort.
+ */
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+#include "cybozu/exception.hpp"
+#include "btree.hpp"
+
+
+constexpr size_t TPCC_NR_DIST_PER_WH = 10;
+constexpr size_t TPCC_NR_CUST_PER_DIST = 3000;
+constexpr size_t TPCC_NR_ITEM = 100000;
+constexpr size_t TPCC_NR_STOCK_PER_WH = 100000;
+constexpr size_t TPCC_MIN_OL_CNT = 5;
+constexpr size_t TPCC_MAX_OL_CNT = 15;
+constexpr size_t TPCC_NR_ORDER_SLOT_PER_DIST = 256; // ring size.
+constexpr uint32_t TPCC_INIT_NEXT_O_ID = 3001;
+constexpr size_t TPCC_MAX_NR_WH = 4096; // for index keys.
+constexpr size_t TPCC_NR_STOCK_LEVEL_ORDER = 20;
+
+
+/*
+ * Money is in cents. Rates are in 1/10000.
+ */
+struct TpccWarehouse
+{
+    int64_t ytd;
+    uint32_t tax;
+    char name[11];
+    char zip[10];
+};
+
+struct TpccDistrict
+{
+    int64_t ytd;
+    uint32_t tax;
+    uint32_t nextOId;
+    char name[11];
+    char zip[10];
+};
+
+struct TpccCustomer
+{
+    int64_t balance;
+    int64_t ytdPayment;
+    uint32_t paymentCnt;
+    uint32_t deliveryCnt;
+    uint32_t discount;
+    char credit[3]; // "GC" or "BC".
+    char last[17];
+};
+
+struct TpccItem
+{
+    uint32_t imId;
+    uint32_t price;
+    char name[25];
+};
+
+struct TpccStock
+{
+    int32_t quantity;
+    uint32_t ytd;
+    uint32_t orderCnt;
+    uint32_t remoteCnt;
+};
+
+struct TpccOrder
+{
+    uint32_t cId;
+    uint32_t olCnt;
+    uint32_t allLocal;
+    uint64_t entryD;
+};
+
+struct TpccNewOrder
+{
+    uint32_t oId;
+};
+
+struct TpccOrderLine
+{
+    uint32_t iId;
+    uint32_t supplyWId;
+    uint32_t quantity;
+    uint32_t amount;
+    uint64_t deliveryD;
+};
+
+struct TpccHistory
+{
+    uint32_t cId;
+    uint32_t cDId;
+    uint32_t cWId;
+    uint32_t dId;
+    uint32_t wId;
+    int64_t amount;
+};
+
+
+template <typename Mutex, typename Data>
+struct TpccRecord
+{
+    Mutex mutex;
+    Data data;
+};
+
+
+template <typename Mutex>
+struct TpccTables
+{
+    template <typename Data>
+    using Table = std::vector<TpccRecord<Mutex, Data> >;
+
+    size_t nrWh;
+    Table<TpccWarehouse> warehouse;
+    Table<TpccDistrict> district;
+    Table<TpccCustomer> customer;
+    Table<TpccItem> item;
+    Table<TpccStock> stock;
+    Table<TpccOrder> order;
+    Table<TpccNewOrder> newOrder;
+    Table<TpccOrderLine> orderLine;
+
+    cybozu::index::BTree orderLineIndex; // orderLineKey() to orderLine slot.
+    cybozu::index::BTree custOrderIndex; // custOrderKey() to order slot.
+
+    TpccTables() : nrWh(0) {}
+
+    /**
+     * Create and load all the tables.
+     */
+    template <typename Random>
+    void init(size_t nrWh0, Random& rand) {
+        if (nrWh0 == 0 || nrWh0 > TPCC_MAX_NR_WH) {
+            throw cybozu::Exception("TpccTables: bad nrWh") << nrWh0;
+        }
+        nrWh = nrWh0;
+        const size_t nrDist = nrWh * TPCC_NR_DIST_PER_WH;
+        const size_t nrOrder = nrDist * TPCC_NR_ORDER_SLOT_PER_DIST;
+        warehouse = Table<TpccWarehouse>(nrWh);
+        district = Table<TpccDistrict>(nrDist);
+        customer = Table<TpccCustomer>(nrDist * TPCC_NR_CUST_PER_DIST);
+        item = Table<TpccItem>(TPCC_NR_ITEM);
+        stock = Table<TpccStock>(nrWh * TPCC_NR_STOCK_PER_WH);
+        order = Table<TpccOrder>(nrOrder);
+        newOrder = Table<TpccNewOrder>(nrOrder);
+        orderLine = Table<TpccOrderLine>(nrOrder * TPCC_MAX_OL_CNT);
+
+        for (auto& rec : warehouse) {
+            TpccWarehouse& w = rec.data;
+            ::memset(&w, 0, sizeof(w));
+            w.ytd = 30000000;
+            w.tax = rand() % 2001;
+            setStr(w.name, "warehouse");
+            setStr(w.zip, "123456789");
+        }
+        for (auto& rec : district) {
+            TpccDistrict& d = rec.data;
+            ::memset(&d, 0, sizeof(d));
+            d.ytd = 3000000;
+            d.tax = rand() % 2001;
+            d.nextOId = TPCC_INIT_NEXT_O_ID;
+            setStr(d.name, "district");
+            setStr(d.zip, "123456789");
+        }
+        for (auto& rec : customer) {
+            TpccCustomer& c = rec.data;
+            ::memset(&c, 0, sizeof(c));
+            c.balance = -1000;
+            c.ytdPayment = 1000;
+            c.paymentCnt = 1;
+            c.discount = rand() % 5001;
+            setStr(c.credit, rand() % 10 == 0 ? "BC" : "GC");
+            setStr(c.last, "customer");
+        }
+        for (auto& rec : item) {
+            TpccItem& i = rec.data;
+            ::memset(&i, 0, sizeof(i));
+            i.imId = rand() % 10000 + 1;
+            i.price = rand() % 9901 + 100;
+            setStr(i.name, "item");
+        }
+        for (auto& rec : stock) {
+            TpccStock& s = rec.data;
+            ::memset(&s, 0, sizeof(s));
+            s.quantity = rand() % 91 + 10;
+        }
+        for (auto& rec : order) ::memset(&rec.data, 0, sizeof(rec.data));
+        for (auto& rec : newOrder) ::memset(&rec.data, 0, sizeof(rec.data));
+        for (auto& rec : orderLine) ::memset(&rec.data, 0, sizeof(rec.data));
+        orderLineIndex.clear();
+        custOrderIndex.clear();
+    }
+
+    /*
+     * All ids are 0-origin.
+     */
+    size_t distIdx(size_t wId, size_t dId) const {
+        assert(wId < nrWh && dId < TPCC_NR_DIST_PER_WH);
+        return wId * TPCC_NR_DIST_PER_WH + dId;
+    }
+    size_t custIdx(size_t wId, size_t dId, size_t cId) const {
+        assert(cId < TPCC_NR_CUST_PER_DIST);
+        return distIdx(wId, dId) * TPCC_NR_CUST_PER_DIST + cId;
+    }
+    size_t stockIdx(size_t wId, size_t iId) const {
+        assert(wId < nrWh && iId < TPCC_NR_ITEM);
+        return wId * TPCC_NR_STOCK_PER_WH + iId;
+    }
+    size_t orderIdx(size_t wId, size_t dId, size_t oId) const {
+        return distIdx(wId, dId) * TPCC_NR_ORDER_SLOT_PER_DIST + oId % TPCC_NR_ORDER_SLOT_PER_DIST;
+    }
+    size_t orderLineIdx(size_t wId, size_t dId, size_t oId, size_t olNum) const {
+        assert(olNum < TPCC_MAX_OL_CNT);
+        return orderIdx(wId, dId, oId) * TPCC_MAX_OL_CNT + olNum;
+    }
+    /*
+     * Index keys ordered by the columns.
+     * wId:12bits dId:4bits oId:40bits olNum:8bits.
+     */
+    static uint64_t orderLineKey(uint64_t wId, uint64_t dId, uint64_t oId, uint64_t olNum) {
+        return (((wId << 4 | dId) << 40 | oId) << 8) | olNum;
+    }
+    /*
+     * wId:12bits dId:4bits cId:12bits oId:36bits.
+     */
+    static uint64_t custOrderKey(uint64_t wId, uint64_t dId, uint64_t cId, uint64_t oId) {
+        return (((wId << 4 | dId) << 12 | cId) << 36) | oId;
+    }
+private:
+    template <size_t size>
+    static void setStr(char (&dst)[size], const char *src) {
+        const size_t len = std::min(::strlen(src), size - 1);
+        ::memcpy(dst, src, len);
+        dst[len] = '\0';
+    }
+};
+
+
+struct TpccNewOrderIn
+{
+    uint32_t wId;
+    uint32_t dId;
+    uint32_t cId;
+    uint32_t olCnt;
+    struct Line {
+        uint32_t iId;
+        uint32_t supplyWId;
+        uint32_t quantity;
+    } lines[TPCC_MAX_OL_CNT];
+};
+
+struct TpccPaymentIn
+{
+    uint32_t wId;
+    uint32_t dId;
+    uint32_t cWId;
+    uint32_t cDId;
+    uint32_t cId;
+    int64_t amount;
+};
+
+
+struct TpccOrderStatusIn
+{
+    uint32_t wId;
+    uint32_t dId;
+    uint32_t cId;
+};
+
+struct TpccStockLevelIn
+{
+    uint32_t wId;
+    uint32_t dId;
+    uint32_t threshold;
+};
+
+
+enum class TpccTxType : uint8_t { NEW_ORDER = 0, PAYMENT = 1, ORDER_STATUS = 2, STOCK_LEVEL = 3, };
+
+
+/**
+ * Random must have operator() that returns uint64_t uniform random value.
+ */
+template <typename Random>
+class TpccTxGenerator
+{
+    Random& rand_;
+    const size_t nrWh_;
+    const uint32_t homeWId_;
+
+    // C values of NURand().
+    static constexpr uint32_t C_CUST_ID = 259;
+    static constexpr uint32_t C_ITEM_ID = 7911;
+
+public:
+    TpccTxGenerator(Random& rand, size_t nrWh, size_t homeWId)
+        : rand_(rand), nrWh_(nrWh), homeWId_(homeWId) {
+        assert(homeWId < nrWh);
+    }
+    TpccTxType chooseType() {
+        const size_t v = rand_() % (45 + 43 + 4 + 4);
+        if (v < 45) return TpccTxType::NEW_ORDER;
+        if (v < 45 + 43) return TpccTxType::PAYMENT;
+        if (v < 45 + 43 + 4) return TpccTxType::ORDER_STATUS;
+        return TpccTxType::STOCK_LEVEL;
+    }
+    void fill(TpccNewOrderIn& in) {
+        in.wId = homeWId_;
+        in.dId = randRange(0, TPCC_NR_DIST_PER_WH - 1);
+        in.cId = nuRand(1023, 0, TPCC_NR_CUST_PER_DIST - 1, C_CUST_ID);
+        in.olCnt = randRange(TPCC_MIN_OL_CNT, TPCC_MAX_OL_CNT);
+        for (size_t i = 0; i < in.olCnt; i++) {
+            TpccNewOrderIn::Line& line = in.lines[i];
+            // Items in an order are distinct.
+            for (;;) {
+                line.iId = nuRand(8191, 0, TPCC_NR_ITEM - 1, C_ITEM_ID);
+                bool found = false;
+                for (size_t j = 0; j < i; j++) {
+                    if (in.lines[j].iId == line.iId) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) break;
+            }
+            line.supplyWId = (nrWh_ > 1 && rand_() % 100 == 0) ? remoteWId() : homeWId_;
+            line.quantity = randRange(1, 10);
+        }
+    }
+    void fill(TpccPaymentIn& in) {
+        in.wId = homeWId_;
+        in.dId = randRange(0, TPCC_NR_DIST_PER_WH - 1);
+        if (nrWh_ > 1 && rand_() % 100 < 15) {
+            in.cWId = remoteWId();
+            in.cDId = randRange(0, TPCC_NR_DIST_PER_WH - 1);
+        } else {
+            in.cWId = in.wId;
+            in.cDId = in.dId;
+        }
+        in.cId = nuRand(1023, 0, TPCC_NR_CUST_PER_DIST - 1, C_CUST_ID);
+        in.amount = randRange(100, 500000);
+    }
+    void fill(TpccOrderStatusIn& in) {
+        in.wId = homeWId_;
+        in.dId = randRange(0, TPCC_NR_DIST_PER_WH - 1);
+        in.cId = nuRand(1023, 0, TPCC_NR_CUST_PER_DIST - 1, C_CUST_ID);
+    }
+    void fill(TpccStockLevelIn& in) {
+        in.wId = homeWId_;
+        in.dId = randRange(0, TPCC_NR_DIST_PER_WH - 1);
+        in.threshold = randRange(10, 20);
+    }
+private:
+    uint32_t randRange(uint32_t x, uint32_t y) {
+        assert(x <= y);
+        return x + rand_() % (y - x + 1);
+    }
+    uint32_t nuRand(uint32_t a, uint32_t x, uint32_t y, uint32_t c) {
+        return (((randRange(0, a) | randRange(x, y)) + c) % (y - x + 1)) + x;
+    }
+    uint32_t remoteWId() {
+        assert(nrWh_ > 1);
+        const uint32_t wId = randRange(0, nrWh_ - 2);
+        return wId < homeWId_ ? wId : wId + 1;
+    }
+};
+
+
+template <typename Tx, typename Mutex>
+bool runTpccNewOrder(Tx& tx, TpccTables<Mutex>& db, const TpccNewOrderIn& in, uint64_t now)
+{
+    TpccWarehouse w;
+    if (!tx.read(db.warehouse[in.wId], w)) return false;
+
+    auto& dRec = db.district[db.distIdx(in.wId, in.dId)];
+    TpccDistrict d;
+    if (!tx.read(dRec, d)) return false;
+    const uint32_t oId = d.nextOId;
+    d.nextOId++;
+    if (!tx.write(dRec, d)) return false;
+
+    TpccCustomer c;
+    if (!tx.read(db.customer[db.custIdx(in.wId, in.dId, in.cId)], c)) return false;
+
+    bool allLocal = true;
+    uint64_t total = 0;
+    for (size_t ol = 0; ol < in.olCnt; ol++) {
+        const TpccNewOrderIn::Line& line = in.lines[ol];
+        if (line.supplyWId != in.wId) allLocal = false;
+
+        TpccItem i;
+        if (!tx.read(db.item[line.iId], i)) return false;
+
+        auto& sRec = db.stock[db.stockIdx(line.supplyWId, line.iId)];
+        TpccStock s;
+        if (!tx.read(sRec, s)) return false;
+        if (s.quantity >= int32_t(line.quantity) + 10) {
+            s.quantity -= line.quantity;
+        } else {
+            s.quantity += 91 - line.quantity;
+        }
+        s.ytd += line.quantity;
+        s.orderCnt++;
+        if (line.supplyWId != in.wId) s.remoteCnt++;
+        if (!tx.write(sRec, s)) return false;
+
+        TpccOrderLine olRec;
+        olRec.iId = line.iId;
+        olRec.supplyWId = line.supplyWId;
+        olRec.quantity = line.quantity;
+        olRec.amount = line.quantity * i.price;
+        olRec.deliveryD = 0;
+        total += olRec.amount;
+        if (!tx.write(db.orderLine[db.orderLineIdx(in.wId, in.dId, oId, ol)], olRec)) return false;
+    }
+
+    // The slot of the order oId - TPCC_NR_ORDER_SLOT_PER_DIST is reused.
+    const size_t oIdx = db.orderIdx(in.wId, in.dId, oId);
+    if (oId >= TPCC_INIT_NEXT_O_ID + TPCC_NR_ORDER_SLOT_PER_DIST) {
+        const uint32_t oldOId = oId - TPCC_NR_ORDER_SLOT_PER_DIST;
+        TpccOrder oldO;
+        if (!tx.read(db.order[oIdx], oldO)) return false;
+        tx.erase(db.custOrderIndex, db.custOrderKey(in.wId, in.dId, oldO.cId, oldOId));
+        for (size_t ol = 0; ol < oldO.olCnt; ol++) {
+            tx.erase(db.orderLineIndex, db.orderLineKey(in.wId, in.dId, oldOId, ol));
+        }
+    }
+    TpccOrder o;
+    o.cId = in.cId;
+    o.olCnt = in.olCnt;
+    o.allLocal = allLocal;
+    o.entryD = now;
+    if (!tx.write(db.order[oIdx], o)) return false;
+    tx.insert(db.custOrderIndex, db.custOrderKey(in.wId, in.dId, in.cId, oId), oIdx);
+    for (size_t ol = 0; ol < in.olCnt; ol++) {
+        tx.insert(db.orderLineIndex, db.orderLineKey(in.wId, in.dId, oId, ol), db.orderLineIdx(in.wId, in.dId, oId, ol));
+    }
+
+    TpccNewOrder no;
+    no.oId = oId;
+    if (!tx.write(db.newOrder[db.orderIdx(in.wId, in.dId, oId)], no)) return false;
+
+    // The result is returned to the terminal in the real TPC-C.
+    total = total * (10000 - c.discount) / 10000 * (10000 + w.tax + d.tax) / 10000;
+    (void)total;
+    return true;
+}
+
+
+template <typename Tx, typename Mutex>
+bool runTpccPayment(Tx& tx, TpccTables<Mutex>& db, const TpccPaymentIn& in, TpccHistory& h)
+{
+    auto& wRec = db.warehouse[in.wId];
+    TpccWarehouse w;
+    if (!tx.read(wRec, w)) return false;
+    w.ytd += in.amount;
+    if (!tx.write(wRec, w)) return false;
+
+    auto& dRec = db.district[db.distIdx(in.wId, in.dId)];
+    TpccDistrict d;
+    if (!tx.read(dRec, d)) return false;
+    d.ytd += in.amount;
+    if (!tx.write(dRec, d)) return false;
+
+    auto& cRec = db.customer[db.custIdx(in.cWId, in.cDId, in.cId)];
+    TpccCustomer c;
+    if (!tx.read(cRec, c)) return false;
+    c.balance -= in.amount;
+    c.ytdPayment += in.amount;
+    c.paymentCnt++;
+    if (!tx.write(cRec, c)) return false;
+
+    h.cId = in.cId;
+    h.cDId = in.cDId;
+    h.cWId = in.cWId;
+    h.dId = in.dId;
+    h.wId = in.wId;
+    h.amount = in.amount;
+    return true;
+}
+
+
+template <typename Tx, typename Mutex>
+bool runTpccOrderStatus(Tx& tx, TpccTables<Mutex>& db, const TpccOrderStatusIn& in)
+{
+    TpccCustomer c;
+    if (!tx.read(db.customer[db.custIdx(in.wId, in.dId, in.cId)], c)) return false;
+
+    // The last order of the customer.
+    bool found = false;
+    uint64_t oKey = 0, oIdx = 0;
+    if (!tx.scan(db.custOrderIndex,
+                 db.custOrderKey(in.wId, in.dId, in.cId, 0),
+                 db.custOrderKey(in.wId, in.dId, in.cId + 1, 0),
+                 [&](uint64_t key, uint64_t value) {
+                     found = true;
+                     oKey = key;
+                     oIdx = value;
+                     return true;
+                 })) return false;
+    if (!found) return true;
+
+    TpccOrder o;
+    if (!tx.read(db.order[oIdx], o)) return false;
+    const uint64_t oId = oKey & ((uint64_t(1) << 36) - 1);
+    bool ok = true;
+    if (!tx.scan(db.orderLineIndex,
+                 db.orderLineKey(in.wId, in.dId, oId, 0),
+                 db.orderLineKey(in.wId, in.dId, oId + 1, 0),
+                 [&](uint64_t, uint64_t olIdx) {
+                     TpccOrderLine ol;
+                     ok = tx.read(db.orderLine[olIdx], ol);
+                     return ok;
+                 })) return false;
+    return ok;
+}
+
+
+template <typename Tx, typename Mutex>
+bool runTpccStockLevel(Tx& tx, TpccTables<Mutex>& db, const TpccStockLevelIn& in)
+{
+    TpccDistrict d;
+    if (!tx.read(db.district[db.distIdx(in.wId, in.dId)], d)) return false;
+
+    // Items of the order lines of the last 20 orders.
+    uint32_t iIds[TPCC_NR_STOCK_LEVEL_ORDER * TPCC_MAX_OL_CNT];
+    size_t nrItem = 0;
+    const uint32_t loOId = d.nextOId > TPCC_NR_STOCK_LEVEL_ORDER ? d.nextOId - TPCC_NR_STOCK_LEVEL_ORDER : 0;
+    bool ok = true;
+    if (!tx.scan(db.orderLineIndex,
+                 db.orderLineKey(in.wId, in.dId, loOId, 0),
+                 db.orderLineKey(in.wId, in.dId, d.nextOId, 0),
+                 [&](uint64_t, uint64_t olIdx) {
+                     TpccOrderLine ol;
+                     ok = tx.read(db.orderLine[olIdx], ol);
+                     if (ok && nrItem < sizeof(iIds) / sizeof(iIds[0])) iIds[nrItem++] = ol.iId;
+                     return ok;
+                 })) return false;
+    if (!ok) return false;
+
+    std::sort(&iIds[0], &iIds[nrItem]);
+    nrItem = std::unique(&iIds[0], &iIds[nrItem]) - &iIds[0];
+    size_t lowStock = 0;
+    for (size_t i = 0; i < nrItem; i++) {
+        TpccStock s;
+        if (!tx.read(db.stock[db.stockIdx(in.wId, iIds[i])], s)) return false;
+        if (s.quantity < int32_t(in.threshold)) lowStock++;
+    }
+    // The result is returned to the terminal in the real TPC-C.
+    (void)lowStock;
+    return true;
+}
+
+
+/**
+ * Buffer of deferred writes and index updates.
+ * Writes are applied to the shared records at commit time.
+ *
+ * Index updates are applied after the write set is locked and before
+ * the read set is verified, so that scans of the concurrent transactions
+ * detect them with their node sets. They are undone if the verification fails.
+ * The records the updated keys point to must be in the write set
+ * so that nobody can commit with the keys before the undo.
+ */
+class TpccWriteBuffer
+{
+    struct Entry
+    {
+        void *dst;
+        size_t off;
+        size_t size;
+    };
+    struct IndexEntry
+    {
+        cybozu::index::BTree *index;
+        uint64_t key;
+        uint64_t value; // the erased value for erase.
+        bool isInsert;
+        bool done; // the update has been applied.
+    };
+    std::vector<Entry> entryV_;
+    std::vector<char> buf_;
+    std::vector<IndexEntry> indexV_;
+public:
+    template <typename Data>
+    void add(Data& dst, const Data& src) {
+        const size_t off = buf_.size();
+        buf_.resize(off + sizeof(Data));
+        ::memcpy(&buf_[off], &src, sizeof(Data));
+        entryV_.push_back(Entry{&dst, off, sizeof(Data)});
+    }
+    void addIndexInsert(cybozu::index::BTree& index, uint64_t key, uint64_t value) {
+        indexV_.push_back(IndexEntry{&index, key, value, true, false});
+    }
+    void addIndexErase(cybozu::index::BTree& index, uint64_t key) {
+        indexV_.push_back(IndexEntry{&index, key, 0, false, false});
+    }
+    /**
+     * Index updates are applied in the order they were added.
+     */
+    void applyIndex() {
+        for (IndexEntry& e : indexV_) {
+            if (e.isInsert) {
+                e.done = e.index->insert(e.key, e.value);
+            } else {
+                e.done = e.index->erase(e.key, e.value);
+            }
+        }
+    }
+    void undoIndex() {
+        for (size_t i = indexV_.size(); i > 0; i--) {
+            IndexEntry& e = indexV_[i - 1];
+            if (!e.done) continue;
+            if (e.isInsert) {
+                e.index->erase(e.key);
+            } else {
+                e.index->insert(e.key, e.value);
+            }
+            e.done = false;
+        }
+    }
+    void apply() const {
+        for (const Entry& e : entryV_) {
+            ::memcpy(e.dst, &buf_[e.off], e.size);
+        }
+    }
+    void clear() {
+        entryV_.clear();
+        buf_.clear();
+        indexV_.clear();
+    }
+};
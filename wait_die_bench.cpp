@@ -7,6 +7,7 @@
 
 #include "wait_die.hpp"
 #include "tx_util.hpp"
+#include "ycsb.hpp"
 
 using Lock = cybozu::wait_die::WaitDieLock;
 using Mutex = Lock::Mutex;
@@ -15,21 +16,36 @@ using Mode = Lock::Mode;
 const std::vector<uint> CpuId_ = getCpuIdList(CpuAffinityMode::CORE);
 
 
-struct Shared
+template <typename MutexT>
+struct SharedT
 {
-    std::vector<Mutex> muV;
+    cybozu::huge_page::Vector<MutexT> muV;
     size_t longTxSize;
     size_t nrOp;
     size_t nrWr;
     int shortTxMode;
     int longTxMode;
+    YcsbParam ycsbParam;
 
     GlobalTxIdGenerator globalTxIdGen;
     SimpleTxIdGenerator simpleTxIdGen;
 
-    Shared() : globalTxIdGen(5, 10) {}
+    SharedT() : globalTxIdGen(5, 10) {}
 };
 
+using Shared = SharedT<Mutex>;
+
+
+inline AbortReason abortReason(const cybozu::wait_die::LockSet& lockSet)
+{
+    return lockSet.isUpgradeFailed() ? AbortReason::UPGRADE : AbortReason::DIE;
+}
+
+inline AbortReason abortReason(const cybozu::wait_die::WoundWaitLockSet&)
+{
+    return AbortReason::WOUNDED;
+}
+
 
 template <int txIdGenType>
 Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
@@ -37,7 +53,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -106,6 +122,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
             throw cybozu::Exception("bad txIdGenType") << txIdGenType;
         }
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(lockV.empty());
@@ -116,7 +133,7 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
                 Mode mode = getMode(i);
                 lockV.emplace_back();
                 if (!lockV.back().lock(&muV[muIdV[i]], mode, txId)) {
-                    res.incAbort(isLongTx);
+                    res.incAbort(isLongTx, AbortReason::DIE);
                     abort = true;
                     break;
                 }
@@ -145,13 +162,16 @@ Result worker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit,
 }
 
 
-template <int txIdGenType>
-Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, Shared& shared)
+template <int txIdGenType, typename LockSet>
+Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, SharedT<typename LockSet::Mutex>& shared)
 {
+    using Mutex = typename LockSet::Mutex;
+    using Mode = typename LockSet::Mode;
+
     unused(shouldQuit);
     cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
 
-    std::vector<Mutex>& muV = shared.muV;
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
     const size_t longTxSize = shared.longTxSize;
     const size_t nrOp = shared.nrOp;
     const size_t nrWr = shared.nrWr;
@@ -160,7 +180,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
 
     Result res;
     cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
-    cybozu::wait_die::LockSet lockSet;
+    LockSet lockSet;
     std::vector<size_t> tmpV; // for fillMuIdVecArray.
 
     PriorityIdGenerator<12> priIdGen;
@@ -204,6 +224,7 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
         }
         lockSet.setTxId(txId);
 
+        res.beginTx();
         for (size_t retry = 0;; retry++) {
             if (quit) break; // to quit under starvation.
             assert(lockSet.empty());
@@ -218,7 +239,76 @@ Result worker2(size_t idx, const bool& start, const bool& quit, bool& shouldQuit
             }
             if (abort) {
                 lockSet.clear();
-                res.incAbort(isLongTx);
+                res.incAbort(isLongTx, abortReason(lockSet));
+                continue;
+            }
+
+            res.incCommit(isLongTx);
+            lockSet.clear();
+            res.addRetryCount(isLongTx, retry);
+            break; // retry is not required.
+        }
+    }
+    return res;
+}
+
+
+template <int txIdGenType, typename LockSet>
+Result ycsbWorker(size_t idx, const bool& start, const bool& quit, bool& shouldQuit, SharedT<typename LockSet::Mutex>& shared)
+{
+    using Mutex = typename LockSet::Mutex;
+    using Mode = typename LockSet::Mode;
+
+    unused(shouldQuit);
+    cybozu::thread::setThreadAffinity(::pthread_self(), CpuId_[idx]);
+
+    cybozu::huge_page::Vector<Mutex>& muV = shared.muV;
+    const size_t nrOp = shared.nrOp;
+
+    Result res;
+    cybozu::util::Xoroshiro128Plus rand(::time(0) + idx);
+    YcsbTxGenerator<decltype(rand)> ycsbGen(rand, shared.ycsbParam);
+    std::vector<YcsbAccess> accV;
+    LockSet lockSet;
+
+    PriorityIdGenerator<12> priIdGen;
+    priIdGen.init(idx + 1);
+    TxIdGenerator localTxIdGen(&shared.globalTxIdGen);
+
+    const bool isLongTx = false;
+
+    while (!start) _mm_pause();
+    while (!quit) {
+        ycsbGen.fill(accV, nrOp);
+
+        uint64_t txId;
+        if (txIdGenType == SCALABLE_TXID_GEN) {
+            txId = priIdGen.get(1);
+        } else if (txIdGenType == BULK_TXID_GEN) {
+            txId = localTxIdGen.get();
+        } else if (txIdGenType == SIMPLE_TXID_GEN) {
+            txId = shared.simpleTxIdGen.get();
+        } else {
+            throw cybozu::Exception("bad txIdGenType") << txIdGenType;
+        }
+        lockSet.setTxId(txId);
+
+        res.beginTx();
+        for (size_t retry = 0;; retry++) {
+            if (quit) break; // to quit under starvation.
+            assert(lockSet.empty());
+            bool abort = false;
+            for (const YcsbAccess& acc : accV) {
+                Mode mode = acc.isWrite() ? Mode::X : Mode::S;
+                Mutex& mutex = muV[acc.key];
+                if (!lockSet.lock(mutex, mode)) {
+                    abort = true;
+                    break;
+                }
+            }
+            if (abort) {
+                lockSet.clear();
+                res.incAbort(isLongTx, abortReason(lockSet));
                 continue;
             }
 
@@ -295,41 +385,52 @@ struct CmdLineOptionPlus : CmdLineOption
     using base = CmdLineOption;
 
     int txIdGenType;
+    bool woundWait;
 
     CmdLineOptionPlus(const std::string& description) : CmdLineOption(description) {
         appendOpt(&txIdGenType, 0, "txid-gen", "[id]: txid gen method (0:sclable, 1:bulk, 2:simple)");
+        appendBoolOpt(&woundWait, "ww", ": use wound-wait instead of wait-die.");
     }
     std::string str() const {
-        return cybozu::util::formatString("mode:wait-die ") +
+        return cybozu::util::formatString("mode:%s ", woundWait ? "wound-wait" : "wait-die") +
             base::str() +
             cybozu::util::formatString(" txidGenType:%d", txIdGenType);
     }
 };
 
-void dispatch1(CmdLineOptionPlus& opt, Shared& shared)
+template <int txIdGenType, typename LockSet>
+void runWorker(CmdLineOptionPlus& opt, SharedT<typename LockSet::Mutex>& shared)
+{
+    if (isYcsbWorkload(opt.workload)) {
+        runExec(opt, shared, ycsbWorker<txIdGenType, LockSet>);
+    } else {
+        runExec(opt, shared, worker2<txIdGenType, LockSet>);
+    }
+}
+
+template <typename LockSet>
+void dispatch1(CmdLineOptionPlus& opt, SharedT<typename LockSet::Mutex>& shared)
 {
     switch (opt.txIdGenType) {
     case SCALABLE_TXID_GEN:
-        runExec(opt, shared, worker2<SCALABLE_TXID_GEN>);
+        runWorker<SCALABLE_TXID_GEN, LockSet>(opt, shared);
         break;
     case BULK_TXID_GEN:
-        runExec(opt, shared, worker2<BULK_TXID_GEN>);
+        runWorker<BULK_TXID_GEN, LockSet>(opt, shared);
         break;
     case SIMPLE_TXID_GEN:
-        runExec(opt, shared, worker2<SIMPLE_TXID_GEN>);
+        runWorker<SIMPLE_TXID_GEN, LockSet>(opt, shared);
         break;
     default:
         throw cybozu::Exception("bad txIdGenType") << opt.txIdGenType;
     }
 }
 
-int main(int argc, char *argv[]) try
+template <typename LockSet>
+void dispatch0(CmdLineOptionPlus& opt)
 {
-    CmdLineOptionPlus opt("wait_die_bench: benchmark with wait-die lock.");
-    opt.parse(argc, argv);
-
     if (opt.workload == "custom") {
-        Shared shared;
+        SharedT<typename LockSet::Mutex> shared;
         shared.muV.resize(opt.getNrMu());
         shared.longTxSize = opt.longTxSize;
         shared.nrOp = opt.nrOp;
@@ -337,11 +438,35 @@ int main(int argc, char *argv[]) try
         shared.shortTxMode = opt.shortTxMode;
         shared.longTxMode = opt.longTxMode;
         for (size_t i = 0; i < opt.nrLoop; i++) {
-            dispatch1(opt, shared);
+            dispatch1<LockSet>(opt, shared);
+        }
+    } else if (isYcsbWorkload(opt.workload)) {
+        SharedT<typename LockSet::Mutex> shared;
+        shared.muV.resize(opt.getNrMu());
+        shared.longTxSize = 0;
+        shared.nrOp = opt.nrOp;
+        shared.nrWr = opt.nrWr;
+        shared.shortTxMode = opt.shortTxMode;
+        shared.longTxMode = opt.longTxMode;
+        shared.ycsbParam.init(opt.workload, opt.getNrMu(), opt.theta);
+        for (size_t i = 0; i < opt.nrLoop; i++) {
+            dispatch1<LockSet>(opt, shared);
         }
     } else {
         throw cybozu::Exception("bad workload.") << opt.workload;
     }
+}
+
+int main(int argc, char *argv[]) try
+{
+    CmdLineOptionPlus opt("wait_die_bench: benchmark with wait-die or wound-wait lock.");
+    opt.parse(argc, argv);
+
+    if (opt.woundWait) {
+        dispatch0<cybozu::wait_die::WoundWaitLockSet>(opt);
+    } else {
+        dispatch0<cybozu::wait_die::LockSet>(opt);
+    }
 } catch (std::exception& e) {
     ::fprintf(::stderr, "exeption: %s\n", e.what());
 } catch (...) {
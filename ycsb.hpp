@@ -0,0 +1,146 @@
+#pragma once
+/*
+ * YCSB core workloads (A-F) for the *_bench programs.
+ *
+ * A: 50% read, 50% update.
+ * B: 95% read, 5% update.
+ * C: 100% read.
+ * D: 95% read, 5% insert. Latest records are the hottest.
+ * E: 95% short scan, 5% insert.
+ * F: 50% read, 50% read-modify-write.
+ *
+ * The number of records is fixed in our benchmarks,
+ * so inserts are emulated as blind updates of the newest records.
+ * One transaction consists of nrOp operations.
+ */
+#include <string>
+#include <vector>
+#include <cassert>
+#include "random.hpp"
+#include "zipf.hpp"
+#include "cybozu/exception.hpp"
+
+
+enum class YcsbOpType : uint8_t { READ = 0, UPDATE = 1, RMW = 2, };
+
+
+struct YcsbAccess
+{
+    size_t key;
+    YcsbOpType type;
+
+    bool isRead() const { return type != YcsbOpType::UPDATE; }
+    bool isWrite() const { return type != YcsbOpType::READ; }
+};
+
+
+inline bool isYcsbWorkload(const std::string& workload)
+{
+    return workload.size() == 6 && workload.compare(0, 5, "ycsb-") == 0
+        && 'a' <= workload[5] && workload[5] <= 'f';
+}
+
+
+struct YcsbParam
+{
+    char type; // 'a' to 'f'.
+    size_t nrRec;
+    double theta;
+    double zetan; // pre-computed zeta(nrRec, theta).
+    size_t maxScanLen; // for workload E.
+
+    YcsbParam() : type(0), nrRec(0), theta(0), zetan(0), maxScanLen(100) {}
+    void init(const std::string& workload, size_t nrRec0, double theta0) {
+        if (!isYcsbWorkload(workload)) {
+            throw cybozu::Exception("YcsbParam: bad workload") << workload;
+        }
+        if (nrRec0 == 0) {
+            throw cybozu::Exception("YcsbParam: nrRec must not be 0");
+        }
+        type = workload[5];
+        nrRec = nrRec0;
+        theta = theta0;
+        zetan = cybozu::util::FastZipf<cybozu::util::Xoroshiro128Plus>::zeta(nrRec, theta);
+        maxScanLen = std::min<size_t>(maxScanLen, nrRec);
+    }
+};
+
+
+template <typename Random>
+class YcsbTxGenerator
+{
+    Random& rand_;
+    const YcsbParam& param_;
+    cybozu::util::FastZipf<Random> zipf_;
+    uint64_t mult_; // coprime with nrRec.
+
+public:
+    YcsbTxGenerator(Random& rand, const YcsbParam& param)
+        : rand_(rand), param_(param)
+        , zipf_(rand, param.nrRec, param.theta, param.zetan)
+        , mult_(UINT64_C(2654435761)) {
+        while (gcd(mult_, param_.nrRec) != 1) mult_ += 2;
+    }
+    /**
+     * Fill accesses of a transaction.
+     */
+    void fill(std::vector<YcsbAccess>& accV, size_t nrOp) {
+        accV.clear();
+        for (size_t i = 0; i < nrOp; i++) {
+            const size_t pct = rand_() % 100;
+            switch (param_.type) {
+            case 'a':
+                add(accV, scramble(zipf_()), pct < 50 ? YcsbOpType::READ : YcsbOpType::UPDATE);
+                break;
+            case 'b':
+                add(accV, scramble(zipf_()), pct < 95 ? YcsbOpType::READ : YcsbOpType::UPDATE);
+                break;
+            case 'c':
+                add(accV, scramble(zipf_()), YcsbOpType::READ);
+                break;
+            case 'd':
+                add(accV, latest(zipf_()), pct < 95 ? YcsbOpType::READ : YcsbOpType::UPDATE);
+                break;
+            case 'e':
+                if (pct < 95) {
+                    const size_t key = scramble(zipf_());
+                    const size_t len = rand_() % param_.maxScanLen + 1;
+                    for (size_t j = 0; j < len; j++) {
+                        add(accV, (key + j) % param_.nrRec, YcsbOpType::READ);
+                    }
+                } else {
+                    add(accV, latest(zipf_()), YcsbOpType::UPDATE);
+                }
+                break;
+            case 'f':
+                add(accV, scramble(zipf_()), pct < 50 ? YcsbOpType::READ : YcsbOpType::RMW);
+                break;
+            default:
+                throw cybozu::Exception("YcsbTxGenerator: bad type") << param_.type;
+            }
+        }
+    }
+private:
+    static void add(std::vector<YcsbAccess>& accV, size_t key, YcsbOpType type) {
+        accV.push_back(YcsbAccess{key, type});
+    }
+    /**
+     * Hot keys are spread over the key space like YCSB's scrambled zipfian.
+     * This is a bijection so the distribution is kept.
+     */
+    size_t scramble(size_t rank) const {
+        return (__uint128_t)rank * mult_ % param_.nrRec;
+    }
+    size_t latest(size_t rank) const {
+        assert(rank < param_.nrRec);
+        return param_.nrRec - 1 - rank;
+    }
+    static uint64_t gcd(uint64_t a, uint64_t b) {
+        while (b != 0) {
+            const uint64_t c = a % b;
+            a = b;
+            b = c;
+        }
+        return a;
+    }
+};